@@ -0,0 +1,121 @@
+#include "auto_itrs.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <limits>
+
+#include "fractal.h"
+#include "thread_pool.h"
+#include "view_map.h"
+
+const size_t auto_sample_grid = 128; //per axis
+const size_t min_auto_itrs = 64;
+const size_t max_auto_itrs = (size_t) 1 << 24;
+
+typedef struct probe_args {
+    size_t num_threads;
+    size_t thread_num; //[0, num_threads - 1]
+    size_t limit;
+    size_t num_samples;
+    const complex_t* c;
+    complex_t* z; //carried over between probes so raising the limit only pays for the new iterations
+    size_t* itrs; //iterations done so far, or the escape iteration once escaped
+    uint8_t* escaped;
+} probe_args;
+
+static int probe_samples(void* args) {
+    auto* pargs = (probe_args*) args;
+    for (size_t i = pargs->thread_num; i < pargs->num_samples; i += pargs->num_threads) {
+        if (pargs->escaped[i])
+            continue;
+        size_t const remaining = pargs->limit - pargs->itrs[i];
+        size_t const itr = escape_time(pargs->c[i], remaining, pargs->z[i]);
+        if (itr < remaining)
+            pargs->escaped[i] = 1;
+        pargs->itrs[i] += itr;
+    }
+    return 0;
+}
+
+size_t depth_itrs_guess(complex_t left_top, complex_t right_bottom) {
+    //the default view is 3 wide, every decade of zoom past that tends to want a few hundred more iterations
+    //a degenerate view, whose span is 0 or nan, is guessed as the deepest double can go rather than dividing by it
+    double span = std::max(fabs(right_bottom.real() - left_top.real()), fabs(left_top.imag() - right_bottom.imag()));
+    if (!(span >= std::numeric_limits<double>::min()))
+        span = std::numeric_limits<double>::min();
+    double const depth = std::max(0.0, log10(3.0 / span));
+    return std::max((size_t) 256, (size_t) (250 * (1 + depth)));
+}
+
+size_t choose_max_itrs(complex_t left_top, complex_t right_bottom, double target, thread_pool& pool) {
+    size_t limit = depth_itrs_guess(left_top, right_bottom);
+
+    size_t const num_samples = auto_sample_grid * auto_sample_grid;
+    auto* c = new complex_t[num_samples];
+    auto* z = new complex_t[num_samples];
+    auto* itrs = new size_t[num_samples];
+    auto* escaped = new uint8_t[num_samples];
+    //the view as a grid of auto_sample_grid pixels a side, sampled at their centres
+    view_map<complex_t::value_type> const grid(left_top, right_bottom, auto_sample_grid, auto_sample_grid);
+    for (size_t y = 0; y < auto_sample_grid; y++) {
+        for (size_t x = 0; x < auto_sample_grid; x++) {
+            size_t i = y * auto_sample_grid + x;
+            c[i] = complex_t{grid.real_at(x + 0.5), grid.imag_at(y + 0.5)};
+            z[i] = complex_t{0, 0};
+            itrs[i] = 0;
+            escaped[i] = 0;
+        }
+    }
+
+    size_t const num_threads = pool.size();
+    auto* args = new probe_args[num_threads];
+    auto probe = [&](size_t probe_limit) {
+        for (size_t i = 0; i < num_threads; i++)
+            args[i] = {num_threads, i, probe_limit, num_samples, c, z, itrs, escaped};
+        pool.run(&probe_samples, args);
+    };
+
+    //keep doubling while a meaningful share of the escaping samples only escape in the doubled range
+    probe(limit);
+    size_t ceiling;
+    size_t escaped_total, escaped_late;
+    while (true) {
+        ceiling = std::min(limit * 2, max_auto_itrs);
+        probe(ceiling);
+        escaped_total = 0;
+        escaped_late = 0;
+        for (size_t i = 0; i < num_samples; i++) {
+            if (!escaped[i])
+                continue;
+            escaped_total++;
+            if (itrs[i] >= limit)
+                escaped_late++;
+        }
+        if (escaped_total == 0 || escaped_late <= target * escaped_total || ceiling == max_auto_itrs)
+            break;
+        limit = ceiling;
+    }
+
+    //then shrink to the smallest limit that still leaves no more than target of the escaping samples unresolved
+    auto* escape_itrs = new size_t[escaped_total];
+    size_t n = 0;
+    for (size_t i = 0; i < num_samples; i++)
+        if (escaped[i])
+            escape_itrs[n++] = itrs[i];
+    std::sort(escape_itrs, escape_itrs + n);
+    size_t const allowed = target * n;
+    size_t chosen = n > allowed ? escape_itrs[n - allowed - 1] + 1 : min_auto_itrs;
+    chosen = std::clamp(chosen, min_auto_itrs, ceiling);
+
+    printf("Auto iterations: probed %zu samples up to %zu iterations, %zu escaped (%zu past %zu), chose %zu\n",
+           num_samples, ceiling, escaped_total, escaped_late, limit, chosen);
+
+    delete[] escape_itrs;
+    delete[] args;
+    delete[] escaped;
+    delete[] itrs;
+    delete[] z;
+    delete[] c;
+    return chosen;
+}
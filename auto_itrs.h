@@ -0,0 +1,16 @@
+#ifndef FRACTALFUN_AUTO_ITRS_H
+#define FRACTALFUN_AUTO_ITRS_H
+
+#include <cstddef>
+
+#include "complex_t.h"
+#include "thread_pool.h"
+
+//a first guess from how far the view is zoomed in from the default 3 wide one, a few hundred more per decade
+size_t depth_itrs_guess(complex_t left_top, complex_t right_bottom);
+
+//probes a sparse grid over the view and returns the smallest max_itrs for which no more than target
+//of the escaping samples are still escaping past it, starting from a guess based on zoom depth
+size_t choose_max_itrs(complex_t left_top, complex_t right_bottom, double target, thread_pool& pool);
+
+#endif //FRACTALFUN_AUTO_ITRS_H
@@ -0,0 +1,276 @@
+#include "batch.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "lodepng/lodepng.h"
+
+#include "complex_t.h"
+#include "render.h"
+#include "tile_scheduler.h"
+#include "renderer.h"
+#include "image_output.h"
+#include "timing.h"
+
+typedef struct batch_job {
+    size_t line; //in the batch file, to name the job by
+    complex_t left_top;
+    complex_t right_bottom;
+    size_t max_itrs;
+    size_t img_width;
+    size_t img_height;
+    std::string output;
+} batch_job;
+
+typedef struct job_result {
+    size_t threads;
+    double compute;
+    double colour;
+    double write; //filter, deflate and write
+    double wall;
+    size_t itrs;
+    size_t bytes_written;
+    unsigned error;
+} job_result;
+
+//the value after "key": in a flat JSON object, or null if the key isn't there
+static const char* json_value(const char* line, const char* key) {
+    std::string const quoted = std::string("\"") + key + "\"";
+    const char* found = strstr(line, quoted.c_str());
+    if (!found)
+        return nullptr;
+    found += quoted.size();
+    while (*found == ' ' || *found == '\t')
+        found++;
+    if (*found != ':')
+        return nullptr;
+    found++;
+    while (*found == ' ' || *found == '\t')
+        found++;
+    return found;
+}
+
+static bool parse_json_job(const char* line, batch_job& job) {
+    const char* view = json_value(line, "view");
+    if (!view || *view != '[')
+        return false;
+    double coords[4];
+    const char* at = view + 1;
+    for (double& coord : coords) {
+        char* end;
+        coord = strtod(at, &end);
+        if (end == at)
+            return false;
+        at = end;
+        while (*at == ' ' || *at == ',')
+            at++;
+    }
+    job.left_top = {coords[0], coords[1]};
+    job.right_bottom = {coords[2], coords[3]};
+    if (const char* itrs = json_value(line, "itrs"))
+        job.max_itrs = strtoull(itrs, nullptr, 10);
+    if (const char* width = json_value(line, "width"))
+        job.img_width = strtoull(width, nullptr, 10);
+    if (const char* height = json_value(line, "height"))
+        job.img_height = strtoull(height, nullptr, 10);
+    if (const char* output = json_value(line, "output")) {
+        if (*output++ != '"')
+            return false;
+        for (; *output && *output != '"'; output++) {
+            if (*output == '\\' && output[1])
+                output++;
+            job.output += *output;
+        }
+    }
+    return true;
+}
+
+static bool parse_cli_job(char* line, batch_job& job) {
+    double coords[4];
+    size_t coords_added = 0;
+    for (char* token = strtok(line, " \t"); token; token = strtok(nullptr, " \t")) {
+        char* value = nullptr;
+        if (token[0] == '-' && token[1] && (token[1] < '0' || token[1] > '9') && token[1] != '.') {
+            value = strtok(nullptr, " \t");
+            if (!value)
+                return false;
+        }
+        if (!value) {
+            if (coords_added == 4)
+                return false;
+            char* end;
+            coords[coords_added++] = strtod(token, &end);
+            if (end == token)
+                return false;
+        } else if (strcmp(token, "-i") == 0) {
+            job.max_itrs = strtoull(value, nullptr, 0);
+        } else if (strcmp(token, "-w") == 0) {
+            job.img_width = strtoull(value, nullptr, 0);
+        } else if (strcmp(token, "-h") == 0) {
+            job.img_height = strtoull(value, nullptr, 0);
+        } else if (strcmp(token, "-o") == 0) {
+            job.output = value;
+        } else {
+            return false;
+        }
+    }
+    if (coords_added != 4)
+        return false;
+    job.left_top = {coords[0], coords[1]};
+    job.right_bottom = {coords[2], coords[3]};
+    return true;
+}
+
+static bool read_jobs(const char* batch_path, size_t max_itrs, size_t img_width, size_t img_height,
+                      std::vector<batch_job>& jobs) {
+    FILE* file = fopen(batch_path, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open batch file %s\n", batch_path);
+        return false;
+    }
+    bool ok = true;
+    char* line = nullptr;
+    size_t capacity = 0;
+    ssize_t length;
+    for (size_t line_num = 1; (length = getline(&line, &capacity, file)) != -1; line_num++) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            line[--length] = '\0';
+        char* start = line;
+        while (*start == ' ' || *start == '\t')
+            start++;
+        if (*start == '\0' || *start == '#')
+            continue;
+
+        batch_job job{line_num, {}, {}, max_itrs, img_width, img_height, {}};
+        bool const parsed = *start == '{' ? parse_json_job(start, job) : parse_cli_job(start, job);
+        if (!parsed || job.max_itrs == 0 || job.img_width == 0 || job.img_height == 0) {
+            fprintf(stderr, "%s:%zu: not a render, skipping it\n", batch_path, line_num);
+            ok = false;
+            continue;
+        }
+        if (job.output.empty()) {
+            char* filename;
+            asprintf(&filename, "%s/(%.10f, %+.10f)-(%.10f, %+.10f) (%zu itr) (%zupx x %zupx).png", type_name,
+                     real(job.left_top), imag(job.left_top), real(job.right_bottom), imag(job.right_bottom),
+                     job.max_itrs, job.img_width, job.img_height);
+            job.output = filename;
+            free(filename);
+        }
+        jobs.push_back(job);
+    }
+    free(line);
+    fclose(file);
+    return ok;
+}
+
+static void print_result(const batch_job& job, const job_result& result) {
+    printf("%zu\t%zu\t%zux%zu\t%zu\t%.6f\t%.6f\t%.6f\t%.6f\t%.3f\t%zu\t%s\t%s\n", job.line, result.threads,
+           job.img_width, job.img_height, job.max_itrs, result.compute, result.colour, result.write, result.wall,
+           result.itrs * 1e-6, result.bytes_written, result.error ? lodepng_error_text(result.error) : "ok",
+           job.output.c_str());
+}
+
+static void add_write_time(job_result& result, const stage_times& times) {
+    result.write = times.wall[stage_filter] + times.wall[stage_deflate] + times.wall[stage_write];
+}
+
+//Each thread takes whole small jobs until there are none left, reusing its own pixel buffer
+typedef struct small_jobs {
+    const std::vector<batch_job>* jobs;
+    const std::vector<size_t>* indices;
+    std::atomic<size_t> next;
+    std::atomic<size_t> failed;
+} small_jobs;
+
+static int render_small_jobs(void* args) {
+    auto* shared = *(small_jobs**) args;
+    std::vector<uint32_t> pixels;
+    for (size_t i = shared->next++; i < shared->indices->size(); i = shared->next++) {
+        const batch_job& job = (*shared->jobs)[(*shared->indices)[i]];
+        job_result result{1, 0, 0, 0, 0, 0, 0, 0};
+        double const start = wall_now();
+        pixels.resize(job.img_width * job.img_height);
+        tile_scheduler tiles(job.img_width, job.img_height, 1);
+        thread_args targs{1, 0, job.max_itrs, job.img_width, job.img_height, job.left_top, job.right_bottom,
+                          pixels.data(), nullptr, &tiles, 0, 1, 0, 1, true, nullptr, nullptr, 0, 0};
+        compute_fractal(&targs);
+        double const computed = wall_now();
+        tiles.reset();
+        colour_iterations(&targs);
+        double const coloured = wall_now();
+
+        stage_times times{};
+        output_method method;
+        result.error = write_png(job.output.c_str(), pixels.data(), job.img_width, job.img_height, times,
+                                 result.bytes_written, method);
+        result.compute = computed - start;
+        result.colour = coloured - computed;
+        add_write_time(result, times);
+        result.wall = wall_now() - start;
+        result.itrs = targs.counts.itrs;
+        shared->failed += result.error != 0;
+        print_result(job, result);
+    }
+    return 0;
+}
+
+int render_batch(const char* batch_path, size_t max_itrs, size_t img_width, size_t img_height, renderer& r) {
+    thread_pool& pool = r.pool();
+    std::vector<batch_job> jobs;
+    bool ok = read_jobs(batch_path, max_itrs, img_width, img_height, jobs);
+    size_t const num_threads = pool.size();
+
+    mkdir(type_name, S_IRWXU | S_IRWXG | S_IRWXO);
+    std::vector<size_t> small, big;
+    for (size_t i = 0; i < jobs.size(); i++)
+        (jobs[i].img_width * jobs[i].img_height < small_job_pixels ? small : big).push_back(i);
+    printf("Batch of %zu jobs from %s, %zu small ones a thread each, %zu over all %zu threads\n", jobs.size(), batch_path,
+           small.size(), big.size(), num_threads);
+    printf("# line\tthreads\tsize\titrs\tcompute_s\tcolour_s\twrite_s\twall_s\tMiter\tbytes\tstatus\toutput\n");
+    double const batch_start = wall_now();
+
+    small_jobs shared{&jobs, &small, {0}, {0}};
+    std::vector<small_jobs*> small_args(num_threads, &shared);
+    pool.run(&render_small_jobs, small_args.data());
+    size_t failed = shared.failed;
+
+    //big jobs get the pool's tiles the same way a single render does, with the renderer keeping one buffer across them
+    for (size_t index : big) {
+        const batch_job& job = jobs[index];
+        job_result result{num_threads, 0, 0, 0, 0, 0, 0, 0};
+        double const start = wall_now();
+        render_spec spec{};
+        spec.left_top = job.left_top;
+        spec.right_bottom = job.right_bottom;
+        spec.img_width = job.img_width;
+        spec.img_height = job.img_height;
+        spec.max_itrs = job.max_itrs;
+        if (r.prepare(spec)) {
+            fprintf(stderr, "Skipping line %zu\n", job.line);
+            failed++;
+            continue;
+        }
+        r.compute();
+        r.colour();
+
+        output_method method;
+        result.error = r.encode_png(job.output.c_str(), result.bytes_written, method);
+        result.compute = r.times().wall[stage_compute];
+        result.colour = r.times().wall[stage_colour];
+        add_write_time(result, r.times());
+        result.wall = wall_now() - start;
+        result.itrs = r.totals().itrs;
+        failed += result.error != 0;
+        print_result(job, result);
+    }
+
+    printf("Batch done in %f, %zu of %zu jobs failed\n", wall_now() - batch_start, failed, jobs.size());
+    return ok && failed == 0 ? 0 : 1;
+}
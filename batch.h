@@ -0,0 +1,24 @@
+#ifndef FRACTALFUN_BATCH_H
+#define FRACTALFUN_BATCH_H
+
+#include <cstddef>
+
+#include "renderer.h"
+
+//jobs under this many pixels are rendered whole by a single thread, several at once, rather than split into tiles
+const size_t small_job_pixels = (size_t) 1 << 20;
+
+/*
+ * Renders every job in batch_path in this one process and r's pool. Each line that isn't blank or a # comment is a job,
+ * either in the command line's own form
+ *   C1x C1y C2x C2y [-i itrs] [-w width] [-h height] [-o output]
+ * or as a JSON object
+ *   {"view": [C1x, C1y, C2x, C2y], "itrs": 1500, "width": 500, "height": 400, "output": "out.png"}
+ * with anything left out taken from max_itrs, img_width and img_height. Jobs without an output are written into
+ * type_name like a single render would be. Small jobs go first, a whole job per thread, then the rest one after
+ * another through r, with the pool sharing their tiles. One tab separated line of metrics is printed per job as it
+ * finishes. Returns 0 if every job was parsed and written.
+ */
+int render_batch(const char* batch_path, size_t max_itrs, size_t img_width, size_t img_height, renderer& r);
+
+#endif //FRACTALFUN_BATCH_H
@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "lodepng/lodepng.h"
+
+#include "complex_t.h"
+#include "render.h"
+#include "thread_pool.h"
+#include "tile_scheduler.h"
+#include "big_alloc.h"
+#include "checksums.h"
+#include "timing.h"
+
+//Single threaded on purpose so results only move when the code does, one tab separated line per view and stage
+
+typedef struct bench_view {
+    const char* name;
+    complex_t left_top;
+    complex_t right_bottom;
+    size_t max_itrs;
+} bench_view;
+
+const bench_view bench_views[] = {
+        {"default", {-2, 1.5}, {1, -1.5}, 1500},
+        {"seahorse", {-0.7536, 0.1116}, {-0.7436, 0.1016}, 1500},
+        {"interior", {-0.2, 0.2}, {0.1, -0.1}, 1500},
+        {"deep", {-0.743643887087151, 0.131825904255330}, {-0.743643886987151, 0.131825904155330}, 5000},
+};
+
+typedef struct bench_result {
+    double min;
+    double mean;
+} bench_result;
+
+static void add_rep(bench_result& result, size_t reps, double taken) {
+    result.min = std::min(result.min, taken);
+    result.mean += taken / reps;
+}
+
+template<typename F>
+static bench_result time_reps(size_t reps, F func) {
+    bench_result result{1e300, 0};
+    for (size_t r = 0; r < reps; r++) {
+        double const start = wall_now();
+        func();
+        add_rep(result, reps, wall_now() - start);
+    }
+    return result;
+}
+
+static void print_result(const char* view, const char* stage, size_t reps, bench_result result, double work, const char* unit) {
+    printf("%s\t%s\t%zu\t%.6f\t%.6f\t%.3f\t%s\t%.0f\n", view, stage, reps, result.min, result.mean,
+           result.min > 0 ? work / result.min * 1e-6 : 0.0, unit, work);
+}
+
+//hands the filtered scanlines back instead of compressing them, so filtering can be timed alone
+static unsigned capture_zlib(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize,
+                             const LodePNGCompressSettings* settings) {
+    auto* filtered = (std::vector<unsigned char>*) settings->custom_context;
+    filtered->assign(in, in + insize);
+    *out = (unsigned char*) lodepng_malloc(1);
+    *outsize = 1;
+    return 0;
+}
+
+static void bench_view_stages(const bench_view& view, size_t img_width, size_t img_height, size_t reps) {
+    auto* pixels = new uint32_t[img_width * img_height];
+    auto* iterations = new float[img_width * img_height];
+    tile_scheduler tiles(img_width, img_height, 1);
+    thread_args args{1, 0, view.max_itrs, img_width, img_height, view.left_top, view.right_bottom, pixels, iterations,
+                     &tiles, 0, 1, 0, 1, true, nullptr, nullptr, 0, 0};
+
+    bench_result result = time_reps(reps, [&]() {tiles.reset(); compute_fractal(&args);});
+    print_result(view.name, "kernel", reps, result, (double) args.counts.itrs, "Miter/s");
+
+    result = time_reps(reps, [&]() {tiles.reset(); colour_iterations(&args);});
+    print_result(view.name, "colour", reps, result, (double) img_width * img_height, "Mpixel/s");
+
+    std::vector<unsigned char> filtered;
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_raw.colortype = LCT_RGBA;
+    state.info_raw.bitdepth = 8;
+    state.info_png.color.colortype = LCT_RGBA;
+    state.info_png.color.bitdepth = 8;
+    state.encoder.auto_convert = 0;
+    state.encoder.zlibsettings.custom_zlib = &capture_zlib;
+    state.encoder.zlibsettings.custom_context = &filtered;
+    result = time_reps(reps, [&]() {
+        unsigned char* png = nullptr;
+        size_t png_size = 0;
+        lodepng_encode(&png, &png_size, (const unsigned char*) pixels, img_width, img_height, &state);
+        lodepng_free(png);
+    });
+    lodepng_state_cleanup(&state);
+    print_result(view.name, "filter", reps, result, (double) img_width * img_height * 4, "MB/s");
+
+    size_t compressed_size = 0;
+    std::vector<unsigned char> compressed;
+    result = time_reps(reps, [&]() {
+        unsigned char* out = nullptr;
+        lodepng_zlib_compress(&out, &compressed_size, filtered.data(), filtered.size(), &lodepng_default_compress_settings);
+        compressed.assign(out, out + compressed_size);
+        lodepng_free(out);
+    });
+    print_result(view.name, "deflate", reps, result, (double) filtered.size(), "MB/s");
+
+    unsigned checksum = 0;
+    result = time_reps(reps, [&]() {checksum = crc32_update(0, compressed.data(), compressed.size());});
+    print_result(view.name, "crc32", reps, result, (double) compressed.size(), "MB/s");
+
+    result = time_reps(reps, [&]() {checksum = adler32(filtered.data(), filtered.size());});
+    print_result(view.name, "adler32", reps, result, (double) filtered.size(), "MB/s");
+    printf("#\t%s\tcompressed %zu bytes, adler32 %08x\n", view.name, compressed_size, checksum);
+
+    delete[] iterations;
+    delete[] pixels;
+}
+
+//Where the pages of a buffer live only matters with more than one thread, so unlike the rest this uses a pinned pool.
+//The same passes are timed over fresh buffers first touched either all by the main thread, as new[] plus a memset
+//would, or band by band by the thread that owns the band. On a single node machine the two should match.
+static void bench_numa(size_t img_width, size_t img_height, size_t reps, size_t num_threads) {
+    const bench_view& view = bench_views[0];
+    size_t const num_pixels = img_width * img_height;
+    thread_pool pool(num_threads, true);
+    num_threads = pool.size();
+    tile_scheduler tiles(img_width, img_height, num_threads);
+    auto* args = new thread_args[num_threads];
+    printf("#	numa	%zu threads, pinned %s\n", num_threads, pool.pinned() ? "yes" : "no");
+
+    for (int band_touch = 0; band_touch < 2; band_touch++) {
+        bench_result compute{1e300, 0}, colour{1e300, 0};
+        size_t itrs = 0;
+        for (size_t r = 0; r < reps; r++) {
+            auto* pixels = (uint32_t*) big_alloc(num_pixels * sizeof(uint32_t));
+            auto* iterations = (float*) big_alloc(num_pixels * sizeof(float));
+            if (!pixels || !iterations) {
+                fprintf(stderr, "Could not allocate a %zupx x %zupx image\n", img_width, img_height);
+                exit(1);
+            }
+            for (size_t i = 0; i < num_threads; i++)
+                args[i] = {num_threads, i, view.max_itrs, img_width, img_height, view.left_top, view.right_bottom, pixels,
+                           iterations, &tiles, 0, 1, 0, 1, true, nullptr, nullptr, 0, 0};
+            if (band_touch) {
+                pool.run(&first_touch, args);
+            } else {
+                memset(pixels, 0, num_pixels * sizeof(uint32_t));
+                memset(iterations, 0, num_pixels * sizeof(float));
+            }
+
+            tiles.reset();
+            double start = wall_now();
+            pool.run(&compute_fractal, args);
+            add_rep(compute, reps, wall_now() - start);
+            itrs = 0;
+            for (size_t i = 0; i < num_threads; i++)
+                itrs += args[i].counts.itrs;
+
+            tiles.reset();
+            start = wall_now();
+            pool.run(&colour_iterations, args);
+            add_rep(colour, reps, wall_now() - start);
+
+            big_free(iterations, num_pixels * sizeof(float));
+            big_free(pixels, num_pixels * sizeof(uint32_t));
+        }
+        print_result("numa", band_touch ? "kernel_band_touch" : "kernel_main_touch", reps, compute, (double) itrs, "Miter/s");
+        print_result("numa", band_touch ? "colour_band_touch" : "colour_main_touch", reps, colour, (double) num_pixels, "Mpixel/s");
+    }
+    delete[] args;
+}
+
+int main(int argc, char** argv) {
+    size_t img_width = 512;
+    size_t img_height = 512;
+    size_t reps = 3;
+    const char* only_view = nullptr;
+    bool numa = false;
+    size_t numa_threads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-w") == 0) {
+            img_width = strtoull(argv[++i], nullptr, 0);
+        } else if (i + 1 < argc && strcmp(argv[i], "-h") == 0) {
+            img_height = strtoull(argv[++i], nullptr, 0);
+        } else if (i + 1 < argc && strcmp(argv[i], "-reps") == 0) {
+            reps = std::max((size_t) 1, (size_t) strtoull(argv[++i], nullptr, 0));
+        } else if (i + 1 < argc && strcmp(argv[i], "-view") == 0) {
+            only_view = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "-numa") == 0) {
+            numa = true;
+            numa_threads = strtoull(argv[++i], nullptr, 0);
+        } else {
+            fprintf(stderr, "fractalfun_bench [-w width] [-h height] [-reps n] [-view default|seahorse|interior|deep] [-numa threads, 0 for all]\n");
+            return 1;
+        }
+    }
+
+    printf("# fractalfun_bench 1 %s %zux%zu\n", type_name, img_width, img_height);
+    printf("# view\tstage\treps\tmin_s\tmean_s\trate\tunit\twork\n");
+    for (const bench_view& view : bench_views)
+        if (!only_view || strcmp(only_view, view.name) == 0)
+            bench_view_stages(view, img_width, img_height, reps);
+    if (numa)
+        bench_numa(img_width, img_height, reps, numa_threads ? numa_threads : default_thread_count());
+    return 0;
+}
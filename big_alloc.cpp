@@ -0,0 +1,171 @@
+#include "big_alloc.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/mman.h>
+
+static std::atomic<bool> huge_pages_enabled{true};
+static std::atomic<bool> explicit_huge_available{true}; //stops asking once the hugetlbfs pool has said no
+static std::atomic<size_t> explicit_huge_bytes{0};
+static std::atomic<size_t> transparent_huge_bytes{0};
+static std::atomic<size_t> small_page_bytes{0};
+
+//the default huge page size, which is what MAP_HUGETLB without a size flag gives
+static size_t huge_page_size() {
+    static size_t const size = []() {
+        size_t kib = 2048;
+        FILE* meminfo = fopen("/proc/meminfo", "r");
+        if (meminfo) {
+            char line[256];
+            while (fgets(line, sizeof(line), meminfo))
+                if (sscanf(line, "Hugepagesize: %zu kB", &kib) == 1)
+                    break;
+            fclose(meminfo);
+        }
+        return kib * 1024;
+    }();
+    return size;
+}
+
+//the length actually mapped for bytes, big_free has to be able to work it out again from bytes alone
+static size_t mapped_length(size_t bytes) {
+    size_t const huge = huge_page_size();
+    if (bytes >= huge)
+        return (bytes + huge - 1) / huge * huge;
+    size_t const page = 4096;
+    return (bytes + page - 1) / page * page;
+}
+
+static void* map_anonymous(size_t length, int extra_flags) {
+    void* buffer = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+    return buffer == MAP_FAILED ? nullptr : buffer;
+}
+
+//transparent huge pages only cover whole aligned huge pages, so map a huge page extra and trim both ends to align it
+static void* map_transparent(size_t length) {
+    size_t const huge = huge_page_size();
+    auto* raw = (char*) map_anonymous(length + huge, 0);
+    if (!raw)
+        return nullptr;
+    char* aligned = (char*) (((uintptr_t) raw + huge - 1) / huge * huge);
+    if (aligned > raw)
+        munmap(raw, aligned - raw);
+    munmap(aligned + length, raw + huge - aligned);
+    madvise(aligned, length, MADV_HUGEPAGE);
+    return aligned;
+}
+
+void* big_alloc(size_t bytes) {
+    size_t const length = mapped_length(bytes);
+    if (huge_pages_enabled && bytes >= huge_page_size()) {
+        if (explicit_huge_available) {
+            void* buffer = map_anonymous(length, MAP_HUGETLB);
+            if (buffer) {
+                explicit_huge_bytes += length;
+                return buffer;
+            }
+            explicit_huge_available = false;
+        }
+        void* buffer = map_transparent(length);
+        if (buffer) {
+            transparent_huge_bytes += length;
+            return buffer;
+        }
+    }
+    void* buffer = map_anonymous(length, 0);
+    if (buffer)
+        small_page_bytes += length;
+    return buffer;
+}
+
+void big_free(void* buffer, size_t bytes) {
+    if (buffer)
+        munmap(buffer, mapped_length(bytes));
+}
+
+void* big_realloc(void* buffer, size_t old_bytes, size_t new_bytes) {
+    if (!buffer)
+        return big_alloc(new_bytes);
+    size_t const old_length = mapped_length(old_bytes);
+    size_t const new_length = mapped_length(new_bytes);
+    if (old_length == new_length)
+        return buffer;
+    //mremap saves the copy but loses the huge page alignment, so it's only for what would be small pages anyway
+    if (!huge_pages_enabled || new_bytes < huge_page_size()) {
+        void* moved = mremap(buffer, old_length, new_length, MREMAP_MAYMOVE);
+        if (moved != MAP_FAILED)
+            return moved;
+    }
+    void* grown = big_alloc(new_bytes);
+    if (!grown)
+        return nullptr;
+    memcpy(grown, buffer, old_bytes < new_bytes ? old_bytes : new_bytes);
+    big_free(buffer, old_bytes);
+    return grown;
+}
+
+void big_alloc_set_huge_pages(bool enabled) {
+    huge_pages_enabled = enabled;
+}
+
+big_alloc_stats big_alloc_totals() {
+    return {explicit_huge_bytes, transparent_huge_bytes, small_page_bytes};
+}
+
+//lodepng's own allocations are mostly small, only the ones of a huge page or more are worth a mapping. Each block
+//carries its size in front of it so realloc and free know which kind it is
+static size_t const lodepng_header = 16; //keeps the returned pointer as aligned as malloc's
+
+void* lodepng_malloc(size_t size) {
+    size_t const total = size + lodepng_header;
+    void* block = total >= huge_page_size() ? big_alloc(total) : malloc(total);
+    if (!block)
+        return nullptr;
+    *(size_t*) block = size;
+    return (char*) block + lodepng_header;
+}
+
+void* lodepng_realloc(void* ptr, size_t new_size) {
+    if (!ptr)
+        return lodepng_malloc(new_size);
+    void* block = (char*) ptr - lodepng_header;
+    size_t const old_total = *(size_t*) block + lodepng_header;
+    size_t const new_total = new_size + lodepng_header;
+    bool const old_big = old_total >= huge_page_size();
+    bool const new_big = new_total >= huge_page_size();
+
+    void* moved;
+    if (!old_big && !new_big) {
+        moved = realloc(block, new_total);
+    } else if (old_big && new_big) {
+        moved = big_realloc(block, old_total, new_total);
+    } else {
+        moved = new_big ? big_alloc(new_total) : malloc(new_total);
+        if (moved) {
+            memcpy(moved, block, old_total < new_total ? old_total : new_total);
+            if (old_big)
+                big_free(block, old_total);
+            else
+                free(block);
+        }
+    }
+    if (!moved)
+        return nullptr;
+    *(size_t*) moved = new_size;
+    return (char*) moved + lodepng_header;
+}
+
+void lodepng_free(void* ptr) {
+    if (!ptr)
+        return;
+    void* block = (char*) ptr - lodepng_header;
+    size_t const total = *(size_t*) block + lodepng_header;
+    if (total >= huge_page_size())
+        big_free(block, total);
+    else
+        free(block);
+}
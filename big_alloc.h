@@ -0,0 +1,34 @@
+#ifndef FRACTALFUN_BIG_ALLOC_H
+#define FRACTALFUN_BIG_ALLOC_H
+
+#include <cstddef>
+
+//Anonymous mappings for the image sized buffers. Nothing is touched here, so each page lands on the NUMA node of
+//whichever thread writes it first, see first_touch in render.h
+//Anything of a huge page or more is rounded up to whole huge pages and backed by the first of these that works:
+//explicit huge pages from the hugetlbfs pool, transparent huge pages on an aligned mapping, or plain small pages
+
+typedef struct big_alloc_stats {
+    size_t explicit_huge_bytes; //MAP_HUGETLB
+    size_t transparent_huge_bytes; //madvised, whether the kernel really gives huge pages is up to it
+    size_t small_page_bytes;
+} big_alloc_stats;
+
+//returns null on failure
+void* big_alloc(size_t bytes);
+void big_free(void* buffer, size_t bytes);
+//keeps the contents up to the smaller size, may move, returns null and leaves buffer alone on failure
+void* big_realloc(void* buffer, size_t old_bytes, size_t new_bytes);
+
+//off means small pages only, for comparing against
+void big_alloc_set_huge_pages(bool enabled);
+//everything mapped so far, including what has since been freed
+big_alloc_stats big_alloc_totals();
+
+//lodepng is built with LODEPNG_NO_COMPILE_ALLOCATORS and gets these, so its filtered scanlines and zlib output are
+//big allocations too. Anything lodepng hands back has to go to lodepng_free rather than free
+void* lodepng_malloc(size_t size);
+void* lodepng_realloc(void* ptr, size_t new_size);
+void lodepng_free(void* ptr);
+
+#endif //FRACTALFUN_BIG_ALLOC_H
@@ -4,6 +4,7 @@
 
 #include <cstdio>
 #include <cstddef>
+#include <cstdint>
 
 using std::uint32_t;
 
@@ -87,4 +88,67 @@ unsigned char* createBitmapInfoHeader(uint32_t height, uint32_t width) {
     infoHeader[14] = (unsigned char)(BYTES_PER_PIXEL*8);
 
     return infoHeader;
-}
\ No newline at end of file
+}
+
+const uint32_t V4_HEADER_SIZE = 108; //BITMAPV4HEADER, the first one with an alpha mask
+const uint32_t BI_BITFIELDS = 3;
+
+static void put_le32(unsigned char* out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
+uint64_t bmp_file_size(size_t width, size_t height) {
+    return FILE_HEADER_SIZE + V4_HEADER_SIZE + (uint64_t) width * height * 4;
+}
+
+bool bmp_fits(size_t width, size_t height) {
+    //width and height are signed 32 bit, and the height is negated to mark the rows as top down
+    return bmp_file_size(width, height) <= UINT32_MAX && width <= INT32_MAX && height <= INT32_MAX;
+}
+
+int write_bmp(const char* filename, const uint32_t* pixels, size_t width, size_t height, bmp_channel_order order,
+              stage_times& times, size_t& bytes_written, output_method& method) {
+    bytes_written = 0;
+    uint64_t const image_size = (uint64_t) width * height * 4;
+    uint64_t const file_size = bmp_file_size(width, height);
+    if (!bmp_fits(width, height)) {
+        fprintf(stderr, "%zupx x %zupx is %llu bytes as a bitmap, which can only describe files under 4 GiB, write a png instead\n",
+                width, height, (unsigned long long) file_size);
+        return 1;
+    }
+
+    unsigned char header[FILE_HEADER_SIZE + V4_HEADER_SIZE] = {};
+    header[0] = 'B';
+    header[1] = 'M';
+    put_le32(header + 2, file_size);
+    put_le32(header + 10, FILE_HEADER_SIZE + V4_HEADER_SIZE);
+
+    unsigned char* info = header + FILE_HEADER_SIZE;
+    put_le32(info + 0, V4_HEADER_SIZE);
+    put_le32(info + 4, width);
+    put_le32(info + 8, (uint32_t) -(int32_t) height);
+    info[12] = 1; //planes
+    info[14] = 32; //bits per pixel
+    put_le32(info + 16, BI_BITFIELDS);
+    put_le32(info + 20, image_size);
+    put_le32(info + 24, 2835); //72 dpi
+    put_le32(info + 28, 2835);
+    //masks over each pixel read as a little endian 32 bit value
+    put_le32(info + 40, order == bmp_rgba ? 0x000000ff : 0x00ff0000); //red
+    put_le32(info + 44, 0x0000ff00); //green
+    put_le32(info + 48, order == bmp_rgba ? 0x00ff0000 : 0x000000ff); //blue
+    put_le32(info + 52, 0xff000000); //alpha
+    put_le32(info + 56, 0x73524742); //LCS_sRGB, the endpoints and gammas after it are then ignored
+
+    const output_piece pieces[2] = {{header, sizeof(header)}, {pixels, (size_t) image_size}};
+    timing_point const write_start = timing_now();
+    int const error = write_output_file(filename, pieces, 2, method);
+    stage_add(times, stage_write, write_start, timing_now());
+    stage_copied(times, stage_write, file_size);
+    if (!error)
+        bytes_written = file_size;
+    return error;
+}
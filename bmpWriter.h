@@ -1,8 +1,31 @@
 #ifndef FRACTALFUN_BMPWRITER_H
 #define FRACTALFUN_BMPWRITER_H
 
+#include <cstddef>
+#include <cstdint>
+
 #include "colours.h"
+#include "output_file.h"
+#include "timing.h"
 
 void generateBitmapImage(ThreeColour* image, uint32_t height, uint32_t width, char* imageFileName);
 
+//byte order of each packed pixel in memory
+enum bmp_channel_order {
+    bmp_rgba, //what Colour packs
+    bmp_bgra,
+};
+
+//headers and pixels of a width x height bitmap as write_bmp writes it
+uint64_t bmp_file_size(size_t width, size_t height);
+//whether a width x height 32 bit bitmap fits the header's 32 bit sizes, which caps files below 4 GiB
+bool bmp_fits(size_t width, size_t height);
+
+//writes the packed pixels as-is as a top down 32 bit BI_BITFIELDS bitmap, with masks describing the channel order,
+//so there's no conversion or row padding and the buffer goes out in one piece through write_output_file.
+//Images that don't bmp_fits are refused. Adds the write time and bytes to times,
+//returns 0 on success with the file size in bytes_written
+int write_bmp(const char* filename, const uint32_t* pixels, size_t width, size_t height, bmp_channel_order order,
+              stage_times& times, size_t& bytes_written, output_method& method);
+
 #endif //FRACTALFUN_BMPWRITER_H
@@ -0,0 +1,57 @@
+#include "checksums.h"
+
+#include <array>
+#include <cstdint>
+
+unsigned adler32(const unsigned char* data, size_t len, unsigned adler) {
+    unsigned s1 = adler & 0xffff, s2 = adler >> 16;
+    while (len > 0) {
+        size_t amount = len > 5552 ? 5552 : len; //the most that can be summed before s2 could overflow
+        len -= amount;
+        for (size_t i = 0; i < amount; i++) {
+            s1 += data[i];
+            s2 += s1;
+        }
+        data += amount;
+        s1 %= 65521;
+        s2 %= 65521;
+    }
+    return (s2 << 16) | s1;
+}
+
+//as zlib's adler32_combine
+unsigned adler32_combine(unsigned adler1, unsigned adler2, size_t len2) {
+    unsigned long const base = 65521;
+    unsigned long const rem = len2 % base;
+    unsigned long sum1 = adler1 & 0xffff;
+    unsigned long sum2 = (rem * sum1) % base;
+    sum1 += (adler2 & 0xffff) + base - 1;
+    sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + base - rem;
+    if (sum1 >= base)
+        sum1 -= base;
+    if (sum1 >= base)
+        sum1 -= base;
+    if (sum2 >= base << 1)
+        sum2 -= base << 1;
+    if (sum2 >= base)
+        sum2 -= base;
+    return sum1 | (sum2 << 16);
+}
+
+static constexpr std::array<uint32_t, 256> crc32_table = []() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        table[n] = c;
+    }
+    return table;
+}();
+
+unsigned crc32_update(unsigned crc, const unsigned char* data, size_t len) {
+    uint32_t c = crc ^ 0xffffffffu;
+    for (size_t i = 0; i < len; i++)
+        c = crc32_table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffffu;
+}
@@ -0,0 +1,14 @@
+#ifndef FRACTALFUN_CHECKSUMS_H
+#define FRACTALFUN_CHECKSUMS_H
+
+#include <cstddef>
+
+//The zlib and png checksums, which lodepng only runs internally over whole buffers. These carry on from a previous
+//value so a stream can be checked in pieces, start from adler32(nullptr, 0) = 1 and crc32_update(0, ...)
+
+unsigned adler32(const unsigned char* data, size_t len, unsigned adler = 1);
+//the adler32 of two buffers one after the other, from each one's own and the second's length
+unsigned adler32_combine(unsigned adler1, unsigned adler2, size_t len2);
+unsigned crc32_update(unsigned crc, const unsigned char* data, size_t len);
+
+#endif //FRACTALFUN_CHECKSUMS_H
@@ -22,8 +22,8 @@ private:
 
 public:
     [[nodiscard]] uint8_t red()     const {return c_struct.redVal;};
-    [[nodiscard]] uint8_t green()   const {return c_struct.blueVal;};
-    [[nodiscard]] uint8_t blue()    const {return c_struct.greenVal;};
+    [[nodiscard]] uint8_t green()   const {return c_struct.greenVal;};
+    [[nodiscard]] uint8_t blue()    const {return c_struct.blueVal;};
     [[nodiscard]] uint8_t alpha()   const {return c_struct.alphaVal;};
     [[nodiscard]] uint32_t packed() const {return packedVal;};
 
@@ -9,7 +9,7 @@
 
 #ifdef COMPLEX_DOUBLE
     using complex_t = std::complex<double>;
-    char type_name[] = "complex double";
+    inline constexpr char type_name[] = "complex double";
 #endif // COMPLEX_DOUBLE
 
 #ifdef SPLIT_COMPLEX_DOUBLE
@@ -0,0 +1,218 @@
+#include "estimate.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+#include "lodepng/lodepng.h"
+
+#include "big_alloc.h"
+#include "bmpWriter.h"
+#include "fractal.h"
+#include "render.h"
+#include "timing.h"
+#include "view_map.h"
+
+//per axis. The middle of a patch has all 8 neighbours for the anti-aliasing test, and keeping patches small spreads
+//the samples over more of the view, which matters since a few pixels near the boundary hold most of the iterations
+const size_t estimate_patch_size = 4;
+const size_t estimate_patch_grid = 64; //per axis
+
+typedef struct estimate_args {
+    size_t num_threads;
+    size_t thread_num; //[0, num_threads - 1]
+    const render_spec* spec;
+    size_t grid_x, grid_y;
+    size_t patch_width, patch_height;
+    float* iterations; //the patches side by side as one small image, as is pixels
+    uint32_t* pixels;
+    sample_counts counts; //out
+    sample_counts aa_counts; //out
+    size_t interior; //out
+    size_t refinable; //out, pixels with every neighbour in their patch, which are the only ones tested
+    size_t refined; //out
+    double compute_seconds, colour_seconds, aa_seconds; //out
+} estimate_args;
+
+//each patch goes through the passes the render would put it through, one after the other, by the thread that has it
+static int estimate_patches(void* args) {
+    auto* eargs = (estimate_args*) args;
+    const render_spec& spec = *eargs->spec;
+    view_map<complex_t::value_type> const view(spec.left_top, spec.right_bottom, spec.img_width, spec.img_height);
+    size_t const patch_width = eargs->patch_width, patch_height = eargs->patch_height;
+    size_t const sample_width = eargs->grid_x * patch_width, sample_height = eargs->grid_y * patch_height;
+    size_t const samples = spec.aa_samples;
+    float* iterations = eargs->iterations;
+    uint32_t* pixels = eargs->pixels;
+
+    for (size_t patch = eargs->thread_num; patch < eargs->grid_x * eargs->grid_y; patch += eargs->num_threads) {
+        size_t const gx = patch % eargs->grid_x, gy = patch / eargs->grid_x;
+        //in the middle of its share of the image
+        size_t const x0 = gx * spec.img_width / eargs->grid_x + (spec.img_width / eargs->grid_x - patch_width) / 2;
+        size_t const y0 = gy * spec.img_height / eargs->grid_y + (spec.img_height / eargs->grid_y - patch_height) / 2;
+        size_t const sx0 = gx * patch_width, sy0 = gy * patch_height;
+
+        double start = wall_now();
+        for (size_t y = 0; y < patch_height; y++)
+            for (size_t x = 0; x < patch_width; x++)
+                iterations[(sy0 + y) * sample_width + sx0 + x] = sample_index(view.point(x0 + x, y0 + y), spec.max_itrs,
+                                                                               eargs->counts);
+        double stop = wall_now();
+        eargs->compute_seconds += stop - start;
+
+        start = stop;
+        for (size_t y = sy0; y < sy0 + patch_height; y++) {
+            for (size_t x = sx0; x < sx0 + patch_width; x++) {
+                float const itr = iterations[y * sample_width + x];
+                eargs->interior += itr == interior_itr;
+                pixels[y * sample_width + x] = iteration_colour(itr);
+            }
+        }
+        stop = wall_now();
+        eargs->colour_seconds += stop - start;
+
+        if (spec.aa_threshold <= 0 || patch_width < 3 || patch_height < 3)
+            continue;
+        start = stop;
+        for (size_t y = 1; y + 1 < patch_height; y++) {
+            for (size_t x = 1; x + 1 < patch_width; x++) {
+                eargs->refinable++;
+                if (!needs_refinement(iterations, sx0 + x, sy0 + y, sample_width, sample_height, spec.aa_threshold))
+                    continue;
+                eargs->refined++;
+                uint64_t red = 0, green = 0, blue = 0; //as in antialias_fractal, 32 bits overflow past -as 4096
+                for (size_t sy = 0; sy < samples; sy++) {
+                    for (size_t sx = 0; sx < samples; sx++) {
+                        complex_t c = complex_t{view.real_at(x0 + x + (sx + 0.5) / samples),
+                                                view.imag_at(y0 + y + (sy + 0.5) / samples)};
+                        Colour colour{sample_colour(c, spec.max_itrs, eargs->aa_counts)};
+                        red += colour.red();
+                        green += colour.green();
+                        blue += colour.blue();
+                    }
+                }
+                size_t const total = samples * samples;
+                pixels[(sy0 + y) * sample_width + sx0 + x] = Colour{(uint8_t) (red / total), (uint8_t) (green / total),
+                                                                    (uint8_t) (blue / total), 255}.packed();
+            }
+        }
+        eargs->aa_seconds += wall_now() - start;
+    }
+    return 0;
+}
+
+void estimate_render(const render_spec& spec, bool pipelined, bool bitmap, thread_pool& pool, render_estimate& estimate) {
+    estimate = {};
+    size_t const img_width = spec.img_width, img_height = spec.img_height;
+    size_t const patch_width = std::min(estimate_patch_size, img_width);
+    size_t const patch_height = std::min(estimate_patch_size, img_height);
+    size_t const grid_x = std::clamp(img_width / estimate_patch_size, (size_t) 1, estimate_patch_grid);
+    size_t const grid_y = std::clamp(img_height / estimate_patch_size, (size_t) 1, estimate_patch_grid);
+    size_t const sample_width = grid_x * patch_width, sample_height = grid_y * patch_height;
+    size_t const sampled = sample_width * sample_height;
+    std::vector<float> iterations(sampled);
+    std::vector<uint32_t> pixels(sampled);
+
+    size_t const num_threads = pool.size();
+    auto* args = new estimate_args[num_threads];
+    for (size_t i = 0; i < num_threads; i++)
+        args[i] = {num_threads, i, &spec, grid_x, grid_y, patch_width, patch_height, iterations.data(), pixels.data(),
+                   {0, 0}, {0, 0}, 0, 0, 0, 0, 0, 0};
+    pool.run(&estimate_patches, args);
+
+    sample_counts counts{0, 0}, aa_counts{0, 0};
+    size_t interior = 0, refinable = 0, refined = 0;
+    double compute_seconds = 0, colour_seconds = 0, aa_seconds = 0; //summed over threads
+    for (size_t i = 0; i < num_threads; i++) {
+        counts.itrs += args[i].counts.itrs;
+        counts.shortcuts += args[i].counts.shortcuts;
+        aa_counts.itrs += args[i].aa_counts.itrs;
+        interior += args[i].interior;
+        refinable += args[i].refinable;
+        refined += args[i].refined;
+        compute_seconds += args[i].compute_seconds;
+        colour_seconds += args[i].colour_seconds;
+        aa_seconds += args[i].aa_seconds;
+    }
+    delete[] args;
+
+    //the patchwork has seams every few pixels that the real image doesn't, so this errs on the big side.
+    //Every colour is opaque and there are far more than a palette's worth in a full image, so lodepng nearly always
+    //writes RGB, and the pipeline always does. Asking for it here keeps a patchwork with few colours from going to a
+    //palette that the full image wouldn't get
+    size_t encoded_size = 0;
+    double encode_seconds = 0;
+    if (!bitmap) {
+        LodePNGState state;
+        lodepng_state_init(&state);
+        state.info_raw.colortype = LCT_RGBA;
+        state.info_raw.bitdepth = 8;
+        state.info_png.color.colortype = LCT_RGB;
+        state.info_png.color.bitdepth = 8;
+        state.encoder.auto_convert = 0;
+        unsigned char* png = nullptr;
+        double const start = wall_now();
+        unsigned const error = lodepng_encode(&png, &encoded_size, (const unsigned char*) pixels.data(), sample_width,
+                                              sample_height, &state);
+        encode_seconds = wall_now() - start;
+        if (error)
+            fprintf(stderr, "Estimating the png size failed: %s\n", lodepng_error_text(error));
+        lodepng_free(png);
+        lodepng_state_cleanup(&state);
+    }
+
+    double const num_pixels = (double) img_width * img_height;
+    double const scale = num_pixels / sampled;
+    //only the refinable pixels were tested, so their share stands for the whole image
+    double const aa_scale = refinable ? num_pixels / refinable : 0;
+    estimate.sampled_pixels = sampled;
+    estimate.itrs = counts.itrs * scale;
+    estimate.aa_itrs = aa_counts.itrs * aa_scale;
+    estimate.interior_fraction = (double) interior / sampled;
+    estimate.refined_fraction = refinable ? (double) refined / refinable : 0;
+    estimate.compute_seconds = compute_seconds * scale / num_threads;
+    estimate.colour_seconds = colour_seconds * scale / num_threads;
+    estimate.antialias_seconds = aa_seconds * aa_scale / num_threads;
+    estimate.thread_seconds = (compute_seconds + colour_seconds + encode_seconds) * scale + aa_seconds * aa_scale;
+    //the pipeline deflates bands on the pool alongside computing, otherwise the one encoder runs after everything
+    estimate.encode_seconds = encode_seconds * scale / (pipelined ? num_threads : 1);
+    estimate.total_seconds = pipelined ? estimate.thread_seconds / num_threads
+            : estimate.compute_seconds + estimate.colour_seconds + estimate.antialias_seconds + estimate.encode_seconds;
+    estimate.output_bytes = bitmap ? bmp_file_size(img_width, img_height) : (size_t) (encoded_size * scale);
+
+    //the buffers the renderer allocates, then whatever the encoder adds on top of them while they're all still held
+    size_t const pixel_bytes = img_width * img_height * sizeof(uint32_t);
+    bool const keep_iterations = spec.keep_iterations || spec.aa_threshold > 0 || spec.keep_unescaped;
+    size_t const iteration_bytes = keep_iterations ? img_width * img_height * sizeof(float) : 0;
+    //shortcut points are never kept to be continued, every other interior one is
+    double const unescaped_fraction = (double) (interior - std::min(interior, counts.shortcuts)) / sampled;
+    size_t const unescaped_bytes = spec.keep_unescaped
+            ? (size_t) (unescaped_fraction * num_pixels * sizeof(continuation_point)) : 0;
+    size_t encoder_bytes = 0;
+    size_t const rgb_row = img_width * 3;
+    if (pipelined)
+        //every thread can have a band being filtered, a band's rgb and filtered rows with the row above, and any
+        //deflated band waits for the ones above it to be written
+        encoder_bytes = num_threads * ((default_tile_size + 1) * rgb_row + default_tile_size * (rgb_row + 1))
+                + estimate.output_bytes;
+    else if (!bitmap)
+        //lodepng converts to RGB, filters that with a filter byte per row, and the deflated stream is kept whole
+        encoder_bytes = img_height * rgb_row + img_height * (rgb_row + 1) + estimate.output_bytes;
+    estimate.peak_bytes = pixel_bytes + iteration_bytes + unescaped_bytes + encoder_bytes;
+}
+
+void print_estimate(const render_estimate& estimate, size_t num_threads) {
+    printf("Estimated from %zu sampled pixels:\n", estimate.sampled_pixels);
+    printf("Compute: %.3f s for %.4g iterations, %.1f%% of pixels interior\n", estimate.compute_seconds,
+           estimate.itrs, 100 * estimate.interior_fraction);
+    printf("Colour: %.3f s\n", estimate.colour_seconds);
+    if (estimate.aa_itrs > 0 || estimate.refined_fraction > 0)
+        printf("Anti-aliasing: %.3f s for %.4g iterations, %.1f%% of pixels refined\n", estimate.antialias_seconds,
+               estimate.aa_itrs, 100 * estimate.refined_fraction);
+    printf("Encode: %.3f s\n", estimate.encode_seconds);
+    printf("Total: %.3f s with %zu threads, %.3f s on one\n", estimate.total_seconds, num_threads,
+           estimate.thread_seconds);
+    printf("Output: %zu bytes (%.1f MiB), peak memory %zu bytes (%.1f MiB)\n", estimate.output_bytes,
+           estimate.output_bytes / 1048576.0, estimate.peak_bytes, estimate.peak_bytes / 1048576.0);
+}
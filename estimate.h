@@ -0,0 +1,39 @@
+#ifndef FRACTALFUN_ESTIMATE_H
+#define FRACTALFUN_ESTIMATE_H
+
+#include <cstddef>
+
+#include "renderer.h"
+#include "thread_pool.h"
+
+//what a render would cost, extrapolated from the sampled patches to the whole image
+typedef struct render_estimate {
+    size_t sampled_pixels;
+    double itrs; //compute pass
+    double aa_itrs; //anti-aliasing pass, 0 without it
+    double interior_fraction;
+    double refined_fraction; //of all pixels, that anti-aliasing would supersample
+    double compute_seconds; //elapsed with every thread in the pool, as are the other passes
+    double colour_seconds;
+    double antialias_seconds;
+    double encode_seconds; //filter and deflate, not the disk
+    double total_seconds;
+    double thread_seconds; //everything above on a single core
+    size_t output_bytes;
+    size_t peak_bytes; //buffers the render and the encoder hold at once, the largest point of the render
+} render_estimate;
+
+/*
+ * Predicts the time, output size and memory of rendering spec without rendering it, for deciding whether or where a
+ * big render is worth queueing. Small patches of pixels, up to 64K of them in 4px x 4px patches spread evenly over
+ * the view, go through the same sampling, colouring and anti-aliasing test as the real passes do, timed on every
+ * thread of pool, and the colour patches are encoded as a png the way the render would be. Each pass's time per
+ * pixel and the png's bytes per pixel are then scaled up to the full size. Supersampling is timed on the pixels
+ * that would be refined, at the middle of each sample cell rather than jittered, which costs the same.
+ * pipelined and bitmap are the -pipe and -bmp choices, which change how the encoding overlaps and what it makes.
+ */
+void estimate_render(const render_spec& spec, bool pipelined, bool bitmap, thread_pool& pool, render_estimate& estimate);
+
+void print_estimate(const render_estimate& estimate, size_t num_threads);
+
+#endif //FRACTALFUN_ESTIMATE_H
@@ -0,0 +1,87 @@
+#ifndef FRACTALFUN_FRACTAL_H
+#define FRACTALFUN_FRACTAL_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "complex_t.h"
+#include "colours.h"
+
+//stored in the iteration buffer for pixels that never escaped
+constexpr float interior_itr = -1.0f;
+
+typedef struct sample_counts {
+    size_t itrs; //iterations actually run
+    size_t shortcuts; //samples known to be interior without iterating at all
+} sample_counts;
+
+//the main cardioid and the period 2 bulb, which together are most of the set's area, never escape
+inline bool in_main_bulbs(complex_t c) {
+    complex_t::value_type const x = c.real() - 0.25;
+    complex_t::value_type const y2 = c.imag() * c.imag();
+    complex_t::value_type const q = x * x + y2;
+    if (q * (q + x) <= 0.25 * y2)
+        return true;
+    return (c.real() + 1) * (c.real() + 1) + y2 <= 0.0625;
+}
+
+//iterates z from the given starting value, returns the iteration it escaped on or max_itrs if it didn't
+inline size_t escape_time(complex_t c, size_t max_itrs, complex_t& z) {
+    for (size_t itr = 0; itr < max_itrs; itr++) {
+//        z = conj(z) * conj(z) + c; //tricorn
+
+        z = z * z + c; //Mandelbrot
+        if (norm(z) > (4))
+            return itr;
+    }
+    return max_itrs;
+}
+
+inline double continuous_index(size_t itr, complex_t z) {
+    return itr + 1 - (log(2) / abs(z)) / log(2);
+}
+
+inline uint32_t escaped_colour(double continuous_index) {
+    uint8_t red =   ((sin(0.058 * continuous_index + 4) + 1) * (230 / 2.0) + 25);
+    uint8_t green = ((sin(0.0565* continuous_index + 2) + 1) * (230 / 2.0) + 25);
+    uint8_t blue =  ((sin(0.055 * continuous_index + 1) + 1) * (230 / 2.0) + 25);
+    uint8_t alpha = 255;
+    return Colour{red, green, blue, alpha}.packed();
+}
+
+//carries on a sample that has already had start_itr iterations done to get to z, z is left where iteration stopped
+//returns the continuous index, or interior_itr if it still hasn't escaped, and adds the iterations done to counts
+inline float continue_index(complex_t c, complex_t& z, size_t start_itr, size_t max_itrs, sample_counts& counts) {
+    size_t const itr = escape_time(c, max_itrs - start_itr, z);
+    if (start_itr + itr == max_itrs) {
+        counts.itrs += itr;
+        return interior_itr;
+    }
+    counts.itrs += itr + 1;
+    return (float) continuous_index(start_itr + itr, z);
+}
+
+//full sample of a single point from z = 0
+inline float sample_index(complex_t c, size_t max_itrs, sample_counts& counts) {
+    if (in_main_bulbs(c)) {
+        counts.shortcuts++;
+        return interior_itr;
+    }
+    complex_t z = complex_t{0, 0};
+    return continue_index(c, z, 0, max_itrs, counts);
+}
+
+//colour for a continuous index, or the inside colour for interior_itr. Every path colours from the float an index is
+//stored as rather than the double continuous_index returns, so a fresh render, a continued one and one coloured from
+//a saved file agree to the bit. That's a channel value off by one here and there compared to colouring the double
+inline uint32_t iteration_colour(float itr) {
+    if (itr == interior_itr)
+        return inside_colour.packed();
+    return escaped_colour(itr);
+}
+
+inline uint32_t sample_colour(complex_t c, size_t max_itrs, sample_counts& counts) {
+    return iteration_colour(sample_index(c, max_itrs, counts));
+}
+
+#endif //FRACTALFUN_FRACTAL_H
@@ -0,0 +1,170 @@
+#include "histogram.h"
+
+#include <cstring>
+
+#include "colours.h"
+#include "render.h"
+#include "trace.h"
+
+//GCC vector extensions as in the preview kernel, 16 bytes so they're a single register anywhere
+const size_t histogram_vector_bytes = 16;
+typedef float float_lanes __attribute__((vector_size(histogram_vector_bytes)));
+typedef int32_t int_lanes __attribute__((vector_size(histogram_vector_bytes)));
+const size_t histogram_lanes = sizeof(float_lanes) / sizeof(float);
+
+void histogram_prepare(histogram_palette& palette, size_t max_itrs, size_t num_threads) {
+    //continuous indices run up to just under max_itrs + 1
+    palette.bins = std::min(max_itrs + 2, max_histogram_bins);
+    palette.num_threads = num_threads;
+    palette.bin_scale = (float) ((double) palette.bins / (max_itrs + 2));
+    palette.counts.assign(palette.bins * num_threads, 0);
+    palette.slice_totals.assign(num_threads, 0);
+    palette.cdf.assign(palette.bins + 1, 0);
+    if (palette.colours.empty()) {
+        for (size_t i = 0; i <= histogram_colour_steps; i++)
+            palette.colours.push_back(escaped_colour(histogram_colour_span * i / histogram_colour_steps));
+        palette.colours.push_back(inside_colour.packed());
+    }
+}
+
+//the bins thread_num merges and scans
+static void histogram_slice(const histogram_palette& palette, size_t thread_num, size_t& first, size_t& end) {
+    first = palette.bins * thread_num / palette.num_threads;
+    end = palette.bins * (thread_num + 1) / palette.num_threads;
+}
+
+int count_histogram(void* args) {
+    auto* targs = (thread_args*) args;
+    histogram_palette& palette = *targs->histogram;
+    size_t const img_width = targs->img_width;
+    size_t const last_bin = palette.bins - 1;
+    float const bin_scale = palette.bin_scale;
+    uint64_t* counts = palette.counts.data() + targs->thread_num * palette.bins;
+    size_t interior = 0;
+    tile_t tile{};
+    size_t tiles_done = 0, tiles_stolen = 0;
+    while (targs->tiles->claim(targs->thread_num, tile)) {
+        tiles_done++;
+        tiles_stolen += tile.stolen;
+        uint64_t const tile_start = trace_now();
+        for (size_t y = tile.y0; y < tile.y1; y++) {
+            for (size_t x = tile.x0; x < tile.x1; x++) {
+                float const itr = load_index(targs->pixels, targs->iterations, y * img_width + x);
+                if (itr == interior_itr) {
+                    interior++;
+                    continue;
+                }
+                counts[std::min((size_t) (itr * bin_scale), last_bin)]++;
+            }
+        }
+        trace_span("histogram tile", tile_start, "tile", tile.index);
+    }
+    targs->interior_pixels = interior;
+    targs->tiles_done = tiles_done;
+    targs->tiles_stolen = tiles_stolen;
+    return 0;
+}
+
+int merge_histogram(void* args) {
+    auto* targs = (thread_args*) args;
+    histogram_palette& palette = *targs->histogram;
+    uint64_t const trace_start = trace_now();
+    size_t first, end;
+    histogram_slice(palette, targs->thread_num, first, end);
+    uint64_t* merged = palette.counts.data();
+    uint64_t total = 0;
+    for (size_t bin = first; bin < end; bin++) {
+        uint64_t count = merged[bin];
+        for (size_t t = 1; t < palette.num_threads; t++)
+            count += palette.counts[t * palette.bins + bin];
+        merged[bin] = count;
+        total += count;
+    }
+    palette.slice_totals[targs->thread_num] = total;
+    trace_span("merge histogram", trace_start, "bins", (int64_t) (end - first));
+    return 0;
+}
+
+int scan_histogram(void* args) {
+    auto* targs = (thread_args*) args;
+    histogram_palette& palette = *targs->histogram;
+    uint64_t const trace_start = trace_now();
+    size_t first, end;
+    histogram_slice(palette, targs->thread_num, first, end);
+    //every thread adds up the slice totals for itself, there are only as many as there are threads
+    uint64_t below = 0, total = 0;
+    for (size_t t = 0; t < palette.num_threads; t++) {
+        if (t < targs->thread_num)
+            below += palette.slice_totals[t];
+        total += palette.slice_totals[t];
+    }
+    double const share = total ? 1.0 / total : 0;
+    for (size_t bin = first; bin < end; bin++) {
+        palette.cdf[bin] = (float) (below * share);
+        below += palette.counts[bin];
+    }
+    if (end == palette.bins)
+        palette.cdf[end] = (float) (below * share);
+    trace_span("scan histogram", trace_start, "bins", (int64_t) (end - first));
+    return 0;
+}
+
+//one row of a tile, a vector of indices at a time, the interior lanes pointed at the inside colour past the palette
+static void map_row(const histogram_palette& palette, const void* indices, uint32_t* pixels, size_t width) {
+    const float* cdf = palette.cdf.data();
+    const uint32_t* colours = palette.colours.data();
+    int_lanes const last_bin = (int_lanes) {} + (int32_t) (palette.bins - 1);
+    int_lanes const last_step = (int_lanes) {} + (int32_t) histogram_colour_steps;
+    int_lanes const inside = (int_lanes) {} + (int32_t) (histogram_colour_steps + 1);
+    size_t x = 0;
+    for (; x + histogram_lanes <= width; x += histogram_lanes) {
+        //copied in since the indices might be parked in the pixels
+        float_lanes itr;
+        memcpy(&itr, (const float*) indices + x, sizeof(itr));
+        float_lanes const scaled = itr * palette.bin_scale;
+        int_lanes bin = __builtin_convertvector(scaled, int_lanes);
+        bin = bin < 0 ? 0 : bin;
+        bin = bin > last_bin ? last_bin : bin;
+        float_lanes const frac = scaled - __builtin_convertvector(bin, float_lanes);
+        float_lanes low, high;
+        for (size_t l = 0; l < histogram_lanes; l++) {
+            low[l] = cdf[bin[l]];
+            high[l] = cdf[bin[l] + 1];
+        }
+        float_lanes const share = low + frac * (high - low);
+        int_lanes step = __builtin_convertvector(share * (float) histogram_colour_steps + 0.5f, int_lanes);
+        step = step > last_step ? last_step : step;
+        step = step < 0 ? 0 : step;
+        step = itr == interior_itr ? inside : step;
+        for (size_t l = 0; l < histogram_lanes; l++)
+            pixels[x + l] = colours[step[l]];
+    }
+    for (; x < width; x++) {
+        float itr;
+        memcpy(&itr, (const float*) indices + x, sizeof(itr));
+        pixels[x] = histogram_colour(palette, itr);
+    }
+}
+
+int map_histogram(void* args) {
+    auto* targs = (thread_args*) args;
+    const histogram_palette& palette = *targs->histogram;
+    size_t const img_width = targs->img_width;
+    tile_t tile{};
+    size_t tiles_done = 0, tiles_stolen = 0;
+    while (targs->tiles->claim(targs->thread_num, tile)) {
+        tiles_done++;
+        tiles_stolen += tile.stolen;
+        uint64_t const tile_start = trace_now();
+        for (size_t y = tile.y0; y < tile.y1; y++) {
+            size_t const row = y * img_width + tile.x0;
+            const void* indices = targs->iterations ? (const void*) (targs->iterations + row)
+                    : (const void*) (targs->pixels + row);
+            map_row(palette, indices, targs->pixels + row, tile.x1 - tile.x0);
+        }
+        trace_span("histogram colour tile", tile_start, "tile", tile.index);
+    }
+    targs->tiles_done = tiles_done;
+    targs->tiles_stolen = tiles_stolen;
+    return 0;
+}
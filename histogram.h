@@ -0,0 +1,62 @@
+#ifndef FRACTALFUN_HISTOGRAM_H
+#define FRACTALFUN_HISTOGRAM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "fractal.h"
+
+//bins over the continuous index, one per iteration up to this many, fewer iterations per bin past it
+const size_t max_histogram_bins = (size_t) 1 << 16;
+//palette entries over the whole equalised range, with the index spread over histogram_colour_span that's 16 per
+//unit of index, the same as the preview's table, so neighbouring entries are at most a shade apart
+const size_t histogram_colour_steps = 4096;
+//how much of the sine palette the equalised range covers, a bit over two of its cycles
+const double histogram_colour_span = 256;
+
+/*
+ * Histogram equalised colouring. The sine palette is absolute in iterations, so a deep zoom whose pixels all escape
+ * between, say, 9000 and 9040 iterations gets a sliver of it. Here each escaped pixel's colour comes from the share
+ * of escaped pixels with a lower index instead, so whatever range the view has is spread across the palette evenly.
+ *
+ * The shares need every index first, so it runs as passes over the whole image, all on the pool:
+ *   count_histogram     tiled, each thread counts the indices it claims into its own histogram
+ *   merge_histogram     each thread adds up every thread's counts for its own slice of the bins
+ *   scan_histogram      each thread turns its slice into the cumulative share, starting from the slices below it
+ *   map_histogram       tiled, each pixel looks its share up, interpolating within the bin, four at a time
+ * No thread writes anything another reads in the same pass, so the passes need nothing but the pool's barrier.
+ */
+typedef struct histogram_palette {
+    size_t bins;
+    size_t num_threads;
+    float bin_scale; //bins per unit of continuous index
+    std::vector<uint64_t> counts; //bins per thread, thread after thread, then merged into thread 0's
+    std::vector<uint64_t> slice_totals; //escaped pixels in each thread's slice of the bins
+    std::vector<float> cdf; //bins + 1 edges, share of escaped pixels below each
+    std::vector<uint32_t> colours; //histogram_colour_steps + 1 along the palette, then inside_colour
+} histogram_palette;
+
+//sizes the bins for max_itrs and clears the counts, the colours are only filled in the first time
+void histogram_prepare(histogram_palette& palette, size_t max_itrs, size_t num_threads);
+
+//the colour for a continuous index once the cdf is done, or inside_colour for interior_itr
+inline uint32_t histogram_colour(const histogram_palette& palette, float itr) {
+    if (itr == interior_itr)
+        return palette.colours[histogram_colour_steps + 1];
+    float const scaled = itr * palette.bin_scale;
+    size_t const bin = std::min((size_t) std::max(scaled, 0.0f), palette.bins - 1);
+    float const frac = scaled - bin;
+    float const share = palette.cdf[bin] + frac * (palette.cdf[bin + 1] - palette.cdf[bin]);
+    return palette.colours[std::min((size_t) (share * histogram_colour_steps + 0.5f), histogram_colour_steps)];
+}
+
+//the passes, each run with thread_pool::run over an array of thread_args whose histogram points at the palette.
+//count_histogram also fills in interior_pixels, the tiled ones tiles_done and tiles_stolen
+int count_histogram(void* args);
+int merge_histogram(void* args);
+int scan_histogram(void* args);
+int map_histogram(void* args);
+
+#endif //FRACTALFUN_HISTOGRAM_H
@@ -0,0 +1,163 @@
+#include "image_output.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "lodepng/lodepng.h"
+
+#include "big_alloc.h"
+#include "checksums.h"
+#include "trace.h"
+
+//IDAT chunks hold at most 2^31 - 1 bytes, big images get their zlib stream split across several
+const size_t max_idat_size = (size_t) 1 << 30;
+
+//The zlib stream is kept rather than handed back to lodepng, which would copy it into the zlib wrapper, then into
+//the chunk, then the whole png into the file. lodepng gets an empty stream and writes an empty IDAT in its place,
+//which write_png swaps the real chunks into as it writes
+typedef struct idat_capture {
+    timing_point deflate_time;
+    unsigned char* deflated; //the raw deflate stream, from lodepng's allocator
+    size_t deflated_size;
+    unsigned char zlib_header[2];
+    unsigned char adler[4];
+    std::vector<unsigned char> framing; //length and type in front of each IDAT chunk's data, its crc after
+    std::vector<output_piece> pieces; //every IDAT chunk, framing and data, in file order
+} idat_capture;
+
+static void put_be32(unsigned char* out, unsigned value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+//splits header, deflated data and adler into IDAT chunks, computing each chunk's crc on the way
+static void frame_idat(idat_capture* capture) {
+    const output_piece stream[3] = {{capture->zlib_header, 2}, {capture->deflated, capture->deflated_size},
+                                    {capture->adler, 4}};
+    size_t const stream_size = capture->deflated_size + 6;
+    size_t const num_chunks = (stream_size + max_idat_size - 1) / max_idat_size;
+    capture->framing.resize(num_chunks * 12); //sized up front, pieces point into it
+    capture->pieces.clear();
+
+    size_t segment = 0, segment_offset = 0;
+    for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+        size_t const chunk_size = std::min(max_idat_size, stream_size - chunk * max_idat_size);
+        unsigned char* head = &capture->framing[chunk * 12];
+        unsigned char* crc = head + 8;
+        put_be32(head, chunk_size);
+        head[4] = 'I', head[5] = 'D', head[6] = 'A', head[7] = 'T';
+        capture->pieces.push_back({head, 8});
+        unsigned chunk_crc = crc32_update(0, head + 4, 4);
+        for (size_t left = chunk_size; left > 0;) {
+            size_t const amount = std::min(left, stream[segment].size - segment_offset);
+            const unsigned char* data = (const unsigned char*) stream[segment].data + segment_offset;
+            capture->pieces.push_back({data, amount});
+            chunk_crc = crc32_update(chunk_crc, data, amount);
+            left -= amount;
+            segment_offset += amount;
+            if (segment_offset == stream[segment].size)
+                segment++, segment_offset = 0;
+        }
+        put_be32(crc, chunk_crc);
+        capture->pieces.push_back({crc, 4});
+    }
+}
+
+//lodepng_encode is filter and deflate together, so deflate is timed from inside through the custom zlib hook
+static unsigned capture_zlib(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize,
+                             const LodePNGCompressSettings* settings) {
+    auto* capture = (idat_capture*) settings->custom_context;
+    timing_point const start = thread_timing_now();
+    uint64_t const trace_start = trace_now();
+    unsigned error = capture->deflated ? 111 : 0; //only the one IDAT stream is expected
+    if (!error)
+        error = lodepng_deflate(&capture->deflated, &capture->deflated_size, in, insize, settings);
+    trace_span("deflate", trace_start, "bytes", (int64_t) insize);
+    if (!error) {
+        capture->zlib_header[0] = 0x78; //deflate with a 32K window, no dictionary, same as lodepng_zlib_compress
+        capture->zlib_header[1] = 0x01;
+        put_be32(capture->adler, adler32(in, insize));
+        frame_idat(capture);
+    }
+    *out = nullptr;
+    *outsize = 0;
+    timing_point const stop = thread_timing_now();
+    capture->deflate_time.wall += stop.wall - start.wall;
+    capture->deflate_time.cpu += stop.cpu - start.cpu;
+    capture->deflate_time.minor_faults += stop.minor_faults - start.minor_faults;
+    capture->deflate_time.major_faults += stop.major_faults - start.major_faults;
+    return error;
+}
+
+unsigned write_png(const char* filename, const uint32_t* pixels, size_t width, size_t height, stage_times& times,
+                   size_t& bytes_written, output_method& method) {
+    bytes_written = 0;
+
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_raw.colortype = LCT_RGBA;
+    state.info_raw.bitdepth = 8;
+    idat_capture capture{{0, 0, 0, 0}, nullptr, 0, {}, {}, {}, {}};
+    state.encoder.zlibsettings.custom_zlib = &capture_zlib;
+    state.encoder.zlibsettings.custom_context = &capture;
+
+    unsigned char* png = nullptr;
+    size_t png_size = 0;
+    timing_point const start = thread_timing_now();
+    uint64_t const trace_start = trace_now();
+    unsigned error = lodepng_encode(&png, &png_size, (const unsigned char*) pixels, width, height, &state);
+    trace_span("encode png", trace_start);
+    timing_point const stop = thread_timing_now();
+    const timing_point& deflate_time = capture.deflate_time;
+    stage_add(times, stage_filter, stop.wall - start.wall - deflate_time.wall, stop.cpu - start.cpu - deflate_time.cpu,
+              stop.minor_faults - start.minor_faults - deflate_time.minor_faults,
+              stop.major_faults - start.major_faults - deflate_time.major_faults);
+    stage_add(times, stage_deflate, deflate_time.wall, deflate_time.cpu, deflate_time.minor_faults, deflate_time.major_faults);
+    lodepng_state_cleanup(&state);
+
+    //the empty IDAT lodepng wrote comes out and the real ones go in its place
+    const unsigned char* idat = nullptr;
+    if (!error) {
+        const unsigned char* end = png + png_size;
+        for (const unsigned char* chunk = png + 8; chunk + 12 <= end; chunk = lodepng_chunk_next_const(chunk, end)) {
+            if (lodepng_chunk_type_equals(chunk, "IDAT")) {
+                idat = chunk;
+                break;
+            }
+        }
+        if (!idat || !capture.deflated)
+            error = 111;
+    }
+
+    if (!error) {
+        //lodepng only copies the pixels when it picked a different colour mode to write, which it nearly always does
+        LodePNGColorMode written;
+        lodepng_color_mode_init(&written);
+        written.bitdepth = png[24];
+        written.colortype = (LodePNGColorType) png[25];
+        if (written.bitdepth != 8 || written.colortype != LCT_RGBA)
+            stage_copied(times, stage_filter, lodepng_get_raw_size(width, height, &written));
+
+        std::vector<output_piece> pieces;
+        pieces.push_back({png, (size_t) (idat - png)});
+        pieces.insert(pieces.end(), capture.pieces.begin(), capture.pieces.end());
+        pieces.push_back({idat + 12, (size_t) (png + png_size - idat - 12)});
+        size_t file_size = 0;
+        for (const output_piece& piece : pieces)
+            file_size += piece.size;
+
+        timing_point const write_start = timing_now();
+        if (write_output_file(filename, pieces.data(), pieces.size(), method) != 0)
+            error = 79; //lodepng's failed to write file
+        stage_add(times, stage_write, write_start, timing_now());
+        stage_copied(times, stage_write, file_size);
+        if (!error)
+            bytes_written = file_size;
+    }
+    lodepng_free(capture.deflated);
+    lodepng_free(png);
+    return error;
+}
@@ -0,0 +1,15 @@
+#ifndef FRACTALFUN_IMAGE_OUTPUT_H
+#define FRACTALFUN_IMAGE_OUTPUT_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "output_file.h"
+#include "timing.h"
+
+//encodes pixels as a png and writes it out, adding filter, deflate and write time and bytes copied to times
+//returns the lodepng error code, 0 on success, with the file size in bytes_written and how it was written in method
+unsigned write_png(const char* filename, const uint32_t* pixels, size_t width, size_t height, stage_times& times,
+                   size_t& bytes_written, output_method& method);
+
+#endif //FRACTALFUN_IMAGE_OUTPUT_H
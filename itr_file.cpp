@@ -0,0 +1,435 @@
+#include "itr_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lodepng/lodepng.h"
+
+#include "big_alloc.h"
+#include "fractal.h"
+#include "thread_pool.h"
+#include "tile_scheduler.h"
+
+static_assert(std::endian::native == std::endian::little, "iteration files are written straight from memory");
+
+static const char itr_file_magic[4] = {'F', 'F', 'I', 'T'};
+static const uint32_t itr_file_version = 2;
+static const size_t v2_header_size = 160;
+static const size_t name_field_size = 32;
+static const size_t record_size = 24;
+//the most deflate can expand by, about 1032:1, which bounds the plane a deflated file can hold
+static const size_t max_deflate_ratio = 1032;
+static const char formula_name[] = "mandelbrot";
+
+static bool write_all(FILE* file, const void* data, size_t size) {
+    return fwrite(data, 1, size, file) == size;
+}
+
+static bool read_all(FILE* file, void* data, size_t size) {
+    return fread(data, 1, size, file) == size;
+}
+
+template<typename T>
+static void put(unsigned char* out, size_t offset, T value) {
+    memcpy(out + offset, &value, sizeof(T));
+}
+
+template<typename T>
+static T get(const unsigned char* in, size_t offset) {
+    T value;
+    memcpy(&value, in + offset, sizeof(T));
+    return value;
+}
+
+static void tile_bounds(size_t width, size_t height, size_t tile_size, size_t tiles_x, size_t tile,
+                        size_t& x0, size_t& y0, size_t& tile_width, size_t& tile_height) {
+    x0 = tile % tiles_x * tile_size;
+    y0 = tile / tiles_x * tile_size;
+    tile_width = std::min(tile_size, width - x0);
+    tile_height = std::min(tile_size, height - y0);
+}
+
+//copies one tile out of the iteration buffer in the file's plane type, returns how many values it holds
+static size_t gather_tile(const itr_file_header& header, const float* iterations, size_t tile_size, size_t tiles_x,
+                          size_t tile, uint32_t* out) {
+    size_t x0, y0, tile_width, tile_height;
+    tile_bounds(header.width, header.height, tile_size, tiles_x, tile, x0, y0, tile_width, tile_height);
+    for (size_t y = 0; y < tile_height; y++) {
+        const float* row = iterations + (y0 + y) * header.width + x0;
+        uint32_t* out_row = out + y * tile_width;
+        if (header.plane_type == itr_plane_float) {
+            memcpy(out_row, row, tile_width * sizeof(float));
+        } else {
+            for (size_t x = 0; x < tile_width; x++)
+                out_row[x] = row[x] == interior_itr ? itr_plane_interior : (uint32_t) row[x];
+        }
+    }
+    return tile_width * tile_height;
+}
+
+//Every thread deflates whichever tile is next until there are none left, into a buffer per tile
+typedef struct tile_deflater {
+    const itr_file_header* header;
+    const float* iterations;
+    size_t tile_size;
+    size_t tiles_x;
+    size_t num_tiles;
+    std::atomic<size_t> next;
+    std::atomic<bool> failed;
+    unsigned char** stored; //from lodepng's allocator
+    size_t* stored_sizes;
+} tile_deflater;
+
+static int deflate_tiles(void* args) {
+    auto* deflater = *(tile_deflater**) args;
+    size_t const max_values = deflater->tile_size * deflater->tile_size;
+    auto* values = new uint32_t[max_values];
+    auto* planes = new unsigned char[max_values * sizeof(uint32_t)];
+    for (size_t tile = deflater->next++; tile < deflater->num_tiles; tile = deflater->next++) {
+        size_t const count = gather_tile(*deflater->header, deflater->iterations, deflater->tile_size,
+                                         deflater->tiles_x, tile, values);
+        const auto* bytes = (const unsigned char*) values;
+        for (size_t i = 0; i < count; i++)
+            for (size_t b = 0; b < sizeof(uint32_t); b++)
+                planes[b * count + i] = bytes[i * sizeof(uint32_t) + b];
+        if (lodepng_zlib_compress(&deflater->stored[tile], &deflater->stored_sizes[tile], planes,
+                                  count * sizeof(uint32_t), &lodepng_default_compress_settings))
+            deflater->failed = true;
+    }
+    delete[] planes;
+    delete[] values;
+    return 0;
+}
+
+int write_itr_file(const char* path, const itr_file_header& header, const float* iterations,
+                   const std::vector<continuation_point>* unescaped, size_t num_lists, thread_pool& pool) {
+    size_t const tile_size = header.tile_size ? header.tile_size : default_tile_size;
+    size_t const tiles_x = (header.width + tile_size - 1) / tile_size;
+    size_t const tiles_y = (header.height + tile_size - 1) / tile_size;
+    size_t const num_tiles = tiles_x * tiles_y;
+    bool const deflated = header.compression == itr_compress_deflate;
+
+    std::vector<unsigned char*> stored(deflated ? num_tiles : 0, nullptr);
+    std::vector<size_t> stored_sizes(num_tiles);
+    bool ok = true;
+    if (deflated) {
+        tile_deflater deflater{&header, iterations, tile_size, tiles_x, num_tiles, {0}, {false}, stored.data(),
+                               stored_sizes.data()};
+        std::vector<tile_deflater*> args(pool.size(), &deflater);
+        pool.run(&deflate_tiles, args.data());
+        ok = !deflater.failed;
+    } else {
+        for (size_t tile = 0; tile < num_tiles; tile++) {
+            size_t x0, y0, tile_width, tile_height;
+            tile_bounds(header.width, header.height, tile_size, tiles_x, tile, x0, y0, tile_width, tile_height);
+            stored_sizes[tile] = tile_width * tile_height * sizeof(uint32_t);
+        }
+    }
+
+    std::vector<uint64_t> table(num_tiles * 2);
+    uint64_t offset = v2_header_size + table.size() * sizeof(uint64_t);
+    for (size_t tile = 0; tile < num_tiles; tile++) {
+        table[tile * 2] = offset;
+        table[tile * 2 + 1] = stored_sizes[tile];
+        offset += stored_sizes[tile];
+    }
+    uint64_t const tiles_end = offset;
+    uint64_t const unescaped_offset = (tiles_end + 7) & ~(uint64_t) 7;
+
+    unsigned char head[v2_header_size]{};
+    memcpy(head, itr_file_magic, sizeof(itr_file_magic));
+    put<uint32_t>(head, 4, itr_file_version);
+    put<uint64_t>(head, 8, header.width);
+    put<uint64_t>(head, 16, header.height);
+    put<double>(head, 24, header.left_top.real());
+    put<double>(head, 32, header.left_top.imag());
+    put<double>(head, 40, header.right_bottom.real());
+    put<double>(head, 48, header.right_bottom.imag());
+    put<uint64_t>(head, 56, header.max_itrs);
+    put<uint64_t>(head, 64, header.num_unescaped);
+    strncpy((char*) head + 72, type_name, name_field_size - 1);
+    strncpy((char*) head + 104, formula_name, name_field_size - 1);
+    put<uint32_t>(head, 136, header.plane_type);
+    put<uint32_t>(head, 140, header.compression);
+    put<uint32_t>(head, 144, tile_size);
+    put<uint64_t>(head, 152, unescaped_offset);
+
+    FILE* file = ok ? fopen(path, "wb") : nullptr;
+    if (ok && !file) {
+        fprintf(stderr, "Could not open %s for writing\n", path);
+        for (unsigned char* tile : stored)
+            lodepng_free(tile);
+        return 1;
+    }
+
+    if (ok)
+        ok = write_all(file, head, sizeof(head)) && write_all(file, table.data(), table.size() * sizeof(uint64_t));
+    auto* values = new uint32_t[tile_size * tile_size];
+    for (size_t tile = 0; ok && tile < num_tiles; tile++) {
+        if (deflated) {
+            ok = write_all(file, stored[tile], stored_sizes[tile]);
+        } else {
+            size_t const count = gather_tile(header, iterations, tile_size, tiles_x, tile, values);
+            ok = write_all(file, values, count * sizeof(uint32_t));
+        }
+    }
+    delete[] values;
+    for (unsigned char* tile : stored)
+        lodepng_free(tile);
+
+    unsigned char const padding[8]{};
+    if (ok)
+        ok = write_all(file, padding, unescaped_offset - tiles_end);
+    for (size_t l = 0; ok && l < num_lists; l++) {
+        for (const continuation_point& point : unescaped[l]) {
+            double const z[2] = {point.z.real(), point.z.imag()};
+            ok = write_all(file, &point.index, sizeof(point.index)) && write_all(file, z, sizeof(z));
+            if (!ok)
+                break;
+        }
+    }
+
+    if (file && fclose(file) != 0)
+        ok = false;
+    if (!ok) {
+        fprintf(stderr, "Failed writing iteration file %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+static int read_itr_file_v2(const char* path, itr_file_header& header, float*& iterations, continuation_point*& unescaped) {
+    itr_file_map map{};
+    if (map_itr_file(path, map))
+        return 1;
+    header = map.header;
+    if (header.plane_type != itr_plane_float || strcmp(map.formula, formula_name) != 0) {
+        fprintf(stderr, "%s holds %s of %s, only a float plane of %s can be continued\n", path,
+                header.plane_type == itr_plane_float ? "floats" : "whole iterations", map.formula, formula_name);
+        unmap_itr_file(map);
+        return 1;
+    }
+
+    //map_itr_file has already held the plane and the records to what the file can hold
+    iterations = new float[header.width * header.height];
+    unescaped = new continuation_point[header.num_unescaped];
+    auto* scratch = new uint32_t[header.tile_size * header.tile_size];
+    bool ok = true;
+    for (size_t tile = 0; ok && tile < map.tiles_x * map.tiles_y; tile++) {
+        const uint32_t* values = itr_file_tile(map, tile, scratch);
+        ok = values != nullptr;
+        size_t x0, y0, tile_width, tile_height;
+        itr_file_tile_bounds(map, tile, x0, y0, tile_width, tile_height);
+        for (size_t y = 0; ok && y < tile_height; y++)
+            memcpy(iterations + (y0 + y) * header.width + x0, values + y * tile_width, tile_width * sizeof(float));
+    }
+    delete[] scratch;
+    for (size_t i = 0; ok && i < header.num_unescaped; i++) {
+        const unsigned char* record = map.unescaped + i * record_size;
+        unescaped[i].index = get<uint64_t>(record, 0);
+        unescaped[i].z = complex_t{get<double>(record, 8), get<double>(record, 16)};
+        ok = unescaped[i].index < header.width * header.height;
+    }
+    unmap_itr_file(map);
+
+    if (!ok) {
+        fprintf(stderr, "Corrupt data in iteration file %s\n", path);
+        delete[] iterations;
+        delete[] unescaped;
+        iterations = nullptr;
+        unescaped = nullptr;
+        return 1;
+    }
+    return 0;
+}
+
+int read_itr_file(const char* path, itr_file_header& header, float*& iterations, continuation_point*& unescaped) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Could not open %s for reading\n", path);
+        return 1;
+    }
+
+    char magic[4];
+    uint32_t version;
+    double coords[4];
+    if (!read_all(file, magic, sizeof(magic)) || memcmp(magic, itr_file_magic, sizeof(magic)) != 0
+            || !read_all(file, &version, sizeof(version)) || (version != 1 && version != itr_file_version)) {
+        fprintf(stderr, "%s is not a version 1 or %u iteration file\n", path, itr_file_version);
+        fclose(file);
+        return 1;
+    }
+    if (version == itr_file_version) {
+        fclose(file);
+        return read_itr_file_v2(path, header, iterations, unescaped);
+    }
+    header = itr_file_header{};
+    if (!read_all(file, &header.width, sizeof(header.width))
+            || !read_all(file, &header.height, sizeof(header.height))
+            || !read_all(file, coords, sizeof(coords))
+            || !read_all(file, &header.max_itrs, sizeof(header.max_itrs))
+            || !read_all(file, &header.num_unescaped, sizeof(header.num_unescaped))) {
+        fprintf(stderr, "Truncated header in iteration file %s\n", path);
+        fclose(file);
+        return 1;
+    }
+    header.left_top = complex_t{coords[0], coords[1]};
+    header.right_bottom = complex_t{coords[2], coords[3]};
+
+    //the plane and the records have to fit in what's left of the file before anything is allocated for them
+    struct stat statbuf{};
+    long const position = ftell(file);
+    bool fits = fstat(fileno(file), &statbuf) == 0 && position >= 0 && statbuf.st_size >= position;
+    uint64_t const remaining = fits ? (uint64_t) (statbuf.st_size - position) : 0;
+    fits = fits && (header.width == 0 || header.height <= remaining / sizeof(float) / header.width);
+    uint64_t const plane_bytes = fits ? header.width * header.height * sizeof(float) : 0;
+    fits = fits && header.num_unescaped <= (remaining - plane_bytes) / record_size;
+    if (!fits) {
+        fprintf(stderr, "Iteration file %s is shorter than its header says\n", path);
+        fclose(file);
+        return 1;
+    }
+
+    iterations = new float[header.width * header.height];
+    unescaped = new continuation_point[header.num_unescaped];
+    bool ok = read_all(file, iterations, header.width * header.height * sizeof(float));
+    for (size_t i = 0; ok && i < header.num_unescaped; i++) {
+        double z[2];
+        ok = read_all(file, &unescaped[i].index, sizeof(unescaped[i].index)) && read_all(file, z, sizeof(z))
+                && unescaped[i].index < header.width * header.height;
+        unescaped[i].z = complex_t{z[0], z[1]};
+    }
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "Truncated or corrupt data in iteration file %s\n", path);
+        delete[] iterations;
+        delete[] unescaped;
+        iterations = nullptr;
+        unescaped = nullptr;
+        return 1;
+    }
+    return 0;
+}
+
+int map_itr_file(const char* path, itr_file_map& map) {
+    int const fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open %s for reading\n", path);
+        return 1;
+    }
+    struct stat statbuf{};
+    if (fstat(fd, &statbuf) != 0 || (size_t) statbuf.st_size < v2_header_size) {
+        fprintf(stderr, "%s is too short to be an iteration file\n", path);
+        close(fd);
+        return 1;
+    }
+    size_t const size = statbuf.st_size;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Could not map %s\n", path);
+        return 1;
+    }
+
+    map = itr_file_map{};
+    map.data = (const unsigned char*) data;
+    map.size = size;
+    const unsigned char* head = map.data;
+    itr_file_header& header = map.header;
+    if (memcmp(head, itr_file_magic, sizeof(itr_file_magic)) != 0 || get<uint32_t>(head, 4) != itr_file_version) {
+        fprintf(stderr, "%s is not a version %u iteration file\n", path, itr_file_version);
+        unmap_itr_file(map);
+        return 1;
+    }
+    header.width = get<uint64_t>(head, 8);
+    header.height = get<uint64_t>(head, 16);
+    header.left_top = complex_t{get<double>(head, 24), get<double>(head, 32)};
+    header.right_bottom = complex_t{get<double>(head, 40), get<double>(head, 48)};
+    header.max_itrs = get<uint64_t>(head, 56);
+    header.num_unescaped = get<uint64_t>(head, 64);
+    memcpy(map.precision, head + 72, name_field_size);
+    memcpy(map.formula, head + 104, name_field_size);
+    header.plane_type = (itr_plane_type) get<uint32_t>(head, 136);
+    header.compression = (itr_compression) get<uint32_t>(head, 140);
+    header.tile_size = get<uint32_t>(head, 144);
+    uint64_t const unescaped_offset = get<uint64_t>(head, 152);
+
+    //everything is checked against the file size here so reading tiles later only has to trust the table
+    bool ok = header.width > 0 && header.height > 0
+            && header.tile_size > 0 && header.tile_size <= max_itr_file_tile_size
+            && header.width <= (1u << 30) && header.height <= (1u << 30)
+            && header.plane_type <= itr_plane_uint32 && header.compression <= itr_compress_deflate;
+    if (ok) {
+        map.tiles_x = (header.width + header.tile_size - 1) / header.tile_size;
+        map.tiles_y = (header.height + header.tile_size - 1) / header.tile_size;
+        size_t const num_tiles = map.tiles_x * map.tiles_y;
+        ok = num_tiles <= (size - v2_header_size) / (2 * sizeof(uint64_t));
+        map.tile_table = (const uint64_t*) (map.data + v2_header_size);
+        for (size_t tile = 0; ok && tile < num_tiles; tile++) {
+            uint64_t const offset = map.tile_table[tile * 2];
+            uint64_t const stored = map.tile_table[tile * 2 + 1];
+            ok = offset <= size && stored <= size - offset;
+            if (ok && header.compression == itr_compress_none) {
+                size_t x0, y0, tile_width, tile_height;
+                itr_file_tile_bounds(map, tile, x0, y0, tile_width, tile_height);
+                ok = stored == tile_width * tile_height * sizeof(uint32_t) && offset % sizeof(uint32_t) == 0;
+            }
+        }
+    }
+    //stored tiles are checked one by one above, deflated ones could still claim a plane far past what the file holds
+    if (ok && header.compression == itr_compress_deflate)
+        ok = header.width * header.height <= size / sizeof(uint32_t) * max_deflate_ratio;
+    if (ok)
+        ok = unescaped_offset <= size && header.num_unescaped <= (size - unescaped_offset) / record_size;
+    if (!ok) {
+        fprintf(stderr, "Corrupt header or tile table in iteration file %s\n", path);
+        unmap_itr_file(map);
+        return 1;
+    }
+    map.unescaped = map.data + unescaped_offset;
+    return 0;
+}
+
+void unmap_itr_file(itr_file_map& map) {
+    if (map.data)
+        munmap((void*) map.data, map.size);
+    map.data = nullptr;
+    map.size = 0;
+}
+
+void itr_file_tile_bounds(const itr_file_map& map, size_t tile, size_t& x0, size_t& y0, size_t& width, size_t& height) {
+    tile_bounds(map.header.width, map.header.height, map.header.tile_size, map.tiles_x, tile, x0, y0, width, height);
+}
+
+const uint32_t* itr_file_tile(const itr_file_map& map, size_t tile, uint32_t* scratch) {
+    const unsigned char* stored = map.data + map.tile_table[tile * 2];
+    size_t const stored_size = map.tile_table[tile * 2 + 1];
+    if (map.header.compression == itr_compress_none)
+        return (const uint32_t*) stored;
+
+    size_t x0, y0, tile_width, tile_height;
+    itr_file_tile_bounds(map, tile, x0, y0, tile_width, tile_height);
+    size_t const count = tile_width * tile_height;
+    unsigned char* planes = nullptr;
+    size_t planes_size = 0;
+    unsigned const error = lodepng_zlib_decompress(&planes, &planes_size, stored, stored_size,
+                                                   &lodepng_default_decompress_settings);
+    bool const ok = !error && planes_size == count * sizeof(uint32_t);
+    if (ok) {
+        auto* bytes = (unsigned char*) scratch;
+        for (size_t i = 0; i < count; i++)
+            for (size_t b = 0; b < sizeof(uint32_t); b++)
+                bytes[i * sizeof(uint32_t) + b] = planes[b * count + i];
+    }
+    lodepng_free(planes);
+    return ok ? scratch : nullptr;
+}
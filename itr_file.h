@@ -0,0 +1,101 @@
+#ifndef FRACTALFUN_ITR_FILE_H
+#define FRACTALFUN_ITR_FILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "complex_t.h"
+
+class thread_pool;
+
+//A pixel that hadn't escaped when the render stopped, enough to carry on iterating it later
+typedef struct continuation_point {
+    uint64_t index; //y * width + x
+    complex_t z; //after max_itrs iterations
+} continuation_point;
+
+enum itr_plane_type : uint32_t {
+    itr_plane_float = 0, //continuous index, interior_itr for pixels that didn't escape
+    itr_plane_uint32 = 1, //whole iterations before escaping, itr_plane_interior for pixels that didn't
+};
+
+enum itr_compression : uint32_t {
+    itr_compress_none = 0,
+    itr_compress_deflate = 1,
+};
+
+const uint32_t itr_plane_interior = 0xffffffff;
+
+typedef struct itr_file_header {
+    uint64_t width;
+    uint64_t height;
+    complex_t left_top;
+    complex_t right_bottom;
+    uint64_t max_itrs;
+    uint64_t num_unescaped;
+    itr_plane_type plane_type;
+    itr_compression compression;
+    uint32_t tile_size; //0 writes default_tile_size
+} itr_file_header;
+
+//biggest tile a mapped file may claim, a decode scratch buffer of this squared is 64 MiB
+const uint32_t max_itr_file_tile_size = 4096;
+
+/*
+ * Iteration file layout, version 2, everything little endian:
+ *   0    "FFIT", uint32 version (2)
+ *   8    uint64 width, uint64 height
+ *   24   double left_top real, imag, right_bottom real, imag
+ *   56   uint64 max_itrs, uint64 num_unescaped
+ *   72   char[32] precision, the type_name of the build that rendered it, nul padded
+ *   104  char[32] formula, "mandelbrot", nul padded
+ *   136  uint32 plane type, itr_plane_type
+ *   140  uint32 compression, itr_compression
+ *   144  uint32 tile size, tiles are that many pixels square, cut short along the right and bottom edges
+ *   148  uint32 0
+ *   152  uint64 offset of the continuation records
+ *   160  a uint64 file offset and uint64 stored size for every tile, row major over the tile grid
+ *        tile data: each tile's 4 byte values row major within the tile. Stored as they are, every tile starts 4 byte
+ *        aligned so it can be read straight out of a mapping. Deflated, each tile is its own zlib stream of the
+ *        values split into byte planes, all the lowest bytes first, which floats from neighbouring pixels compress
+ *        far better as
+ *        num_unescaped records of uint64 index, double z real, z imag, all at max_itrs iterations, 8 byte aligned
+ *
+ * Version 1 files, still read for -continue, are the first 72 bytes with version 1, an untiled float plane and then
+ * the records.
+ */
+
+//A version 2 file mapped read only, every pointer is into the mapping
+typedef struct itr_file_map {
+    itr_file_header header;
+    char precision[33];
+    char formula[33];
+    size_t tiles_x;
+    size_t tiles_y;
+    const unsigned char* data;
+    size_t size;
+    const uint64_t* tile_table; //offset then stored size per tile
+    const unsigned char* unescaped; //num_unescaped 24 byte records
+} itr_file_map;
+
+//unescaped is num_lists vectors (one per thread usually), written back to back. Tiles are deflated on the pool.
+//Returns 0 on success
+int write_itr_file(const char* path, const itr_file_header& header, const float* iterations,
+                   const std::vector<continuation_point>* unescaped, size_t num_lists, thread_pool& pool);
+
+//allocates iterations and unescaped with new[], version 1 or a version 2 float plane, returns 0 on success
+int read_itr_file(const char* path, itr_file_header& header, float*& iterations, continuation_point*& unescaped);
+
+//maps a version 2 file and checks its tile table against the file size, returns 0 on success
+int map_itr_file(const char* path, itr_file_map& map);
+void unmap_itr_file(itr_file_map& map);
+
+//pixels across and down in tile, and where its top left pixel is
+void itr_file_tile_bounds(const itr_file_map& map, size_t tile, size_t& x0, size_t& y0, size_t& width, size_t& height);
+
+//the values of tile, row major and its width across. Points into the mapping when stored as they are, otherwise they
+//are inflated into scratch, which must hold tile_size * tile_size values. nullptr if the tile is corrupt
+const uint32_t* itr_file_tile(const itr_file_map& map, size_t tile, uint32_t* scratch);
+
+#endif //FRACTALFUN_ITR_FILE_H
@@ -1736,7 +1736,7 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
 
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize) {
+static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize, unsigned last) {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
   2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
 
@@ -1747,7 +1747,7 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
     unsigned char firstbyte;
     size_t pos = out->size;
 
-    BFINAL = (i == numdeflateblocks - 1);
+    BFINAL = last && (i == numdeflateblocks - 1);
     BTYPE = 0;
 
     LEN = 65535;
@@ -2066,8 +2066,9 @@ static unsigned deflateFixed(LodePNGBitWriter* writer, Hash* hash,
   return error;
 }
 
+/*FractalFun: last is 0 for every part of a stream but the final one, see lodepng_deflate_part*/
 static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-                                 const LodePNGCompressSettings* settings) {
+                                 const LodePNGCompressSettings* settings, unsigned last) {
   unsigned error = 0;
   size_t i, blocksize, numdeflateblocks;
   Hash hash;
@@ -2076,7 +2077,7 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
   LodePNGBitWriter_init(&writer, out);
 
   if(settings->btype > 2) return 61;
-  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
+  else if(settings->btype == 0) return deflateNoCompression(out, in, insize, last);
   else if(settings->btype == 1) blocksize = insize;
   else /*if(settings->btype == 2)*/ {
     /*on PNGs, deflate blocks of 65-262k seem to give most dense encoding*/
@@ -2092,7 +2093,7 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
 
   if(!error) {
     for(i = 0; i != numdeflateblocks && !error; ++i) {
-      unsigned final = (i == numdeflateblocks - 1);
+      unsigned final = last && (i == numdeflateblocks - 1);
       size_t start = i * blocksize;
       size_t end = start + blocksize;
       if(end > insize) end = insize;
@@ -2104,6 +2105,17 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
 
   hash_cleanup(&hash);
 
+  /*FractalFun: an empty stored block, like zlib's Z_SYNC_FLUSH, ends the part on a byte boundary so the next part's
+  blocks can simply be appended. The bits left in the current byte are already 0*/
+  if(!error && !last) {
+    writeBits(&writer, 0, 3); /*BFINAL 0, BTYPE 00*/
+    if(!ucvector_resize(out, out->size + 4)) return 83; /*alloc fail*/
+    out->data[out->size - 4] = 0;
+    out->data[out->size - 3] = 0;
+    out->data[out->size - 2] = 255;
+    out->data[out->size - 1] = 255;
+  }
+
   return error;
 }
 
@@ -2111,7 +2123,18 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGCompressSettings* settings) {
   ucvector v = ucvector_init(*out, *outsize);
-  unsigned error = lodepng_deflatev(&v, in, insize, settings);
+  unsigned error = lodepng_deflatev(&v, in, insize, settings, 1);
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
+/*FractalFun*/
+unsigned lodepng_deflate_part(unsigned char** out, size_t* outsize,
+                              const unsigned char* in, size_t insize,
+                              const LodePNGCompressSettings* settings, unsigned last) {
+  ucvector v = ucvector_init(*out, *outsize);
+  unsigned error = lodepng_deflatev(&v, in, insize, settings, last);
   *out = v.data;
   *outsize = v.size;
   return error;
@@ -5559,8 +5582,9 @@ static size_t ilog2i(size_t i) {
   return i * l + ((i - (1u << l)) << 1u);
 }
 
-static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
-                       const LodePNGColorMode* color, const LodePNGEncoderSettings* settings) {
+/*FractalFun: first_prevline is the unfiltered row above in, or 0 when in starts the image*/
+static unsigned filter_from(unsigned char* out, const unsigned char* in, const unsigned char* first_prevline,
+                            unsigned w, unsigned h, const LodePNGColorMode* color, const LodePNGEncoderSettings* settings) {
   /*
   For PNG filter method 0
   out must be a buffer with as size: h + (w * h * bpp + 7u) / 8u, because there are
@@ -5573,7 +5597,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
 
   /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise*/
   size_t bytewidth = (bpp + 7u) / 8u;
-  const unsigned char* prevline = 0;
+  const unsigned char* prevline = first_prevline;
   unsigned x, y;
   unsigned error = 0;
   LodePNGFilterStrategy strategy = settings->filter_strategy;
@@ -5753,6 +5777,18 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
   return error;
 }
 
+static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
+                       const LodePNGColorMode* color, const LodePNGEncoderSettings* settings) {
+  return filter_from(out, in, 0, w, h, color, settings);
+}
+
+/*FractalFun*/
+unsigned lodepng_filter_rows(unsigned char* out, const unsigned char* in, const unsigned char* prevline,
+                             unsigned w, unsigned h, const LodePNGColorMode* color,
+                             const LodePNGEncoderSettings* settings) {
+  return filter_from(out, in, prevline, w, h, color, settings);
+}
+
 static void addPaddingBits(unsigned char* out, const unsigned char* in,
                            size_t olinebits, size_t ilinebits, unsigned h) {
   /*The opposite of the removePaddingBits function
@@ -1004,6 +1004,15 @@ unsigned lodepng_chunk_create(unsigned char** out, size_t* outsize, unsigned len
 
 /*Calculate CRC32 of buffer*/
 unsigned lodepng_crc32(const unsigned char* buf, size_t len);
+
+#ifdef LODEPNG_COMPILE_ENCODER
+/*FractalFun: filters h scanlines of in, which is in the color mode given, the same way lodepng_encode would
+as part of a whole image. prevline is the unfiltered scanline just above in, or NULL if in starts the image.
+out needs h * (1 + bytes per scanline) bytes, each scanline gets its filter type byte in front.*/
+unsigned lodepng_filter_rows(unsigned char* out, const unsigned char* in, const unsigned char* prevline,
+                             unsigned w, unsigned h, const LodePNGColorMode* color,
+                             const LodePNGEncoderSettings* settings);
+#endif /*LODEPNG_COMPILE_ENCODER*/
 #endif /*LODEPNG_COMPILE_PNG*/
 
 
@@ -1055,6 +1064,13 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGCompressSettings* settings);
 
+/*FractalFun: deflates one part of a stream made of independently compressed parts, appending to out. Every part
+but the last (last = 0) ends byte aligned with an empty non-final stored block, so the parts can be concatenated in
+order into a single valid deflate stream. Nothing refers back across parts, which costs a little compression.*/
+unsigned lodepng_deflate_part(unsigned char** out, size_t* outsize,
+                              const unsigned char* in, size_t insize,
+                              const LodePNGCompressSettings* settings, unsigned last);
+
 #endif /*LODEPNG_COMPILE_ENCODER*/
 #endif /*LODEPNG_COMPILE_ZLIB*/
 
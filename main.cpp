@@ -1,32 +1,88 @@
 #include <iostream>
 #include <cstdio>
 #include <cstdint>
-#include <ctime>
 #include <cstdlib>
+#include <cstring>
+#include <vector>
 
-#include <unistd.h> //todo: figure out an OS neutral way to get thread count (like asking for it)
-#include <threads.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "lodepng/lodepng.h"
 #include "bmpWriter.h"
 
 #include "complex_t.h"
 #include "colours.h"
+#include "fractal.h"
+#include "thread_pool.h"
+#include "render.h"
+#include "sequence.h"
+#include "timing.h"
+#include "image_output.h"
+#include "metrics.h"
+#include "auto_itrs.h"
+#include "itr_file.h"
+#include "pipeline.h"
+#include "tile_scheduler.h"
+#include "big_alloc.h"
+#include "renderer.h"
+#include "serve.h"
+#include "batch.h"
+#include "preview.h"
+#include "view_map.h"
+#include "perf_counters.h"
+#include "trace.h"
+#include "tile_costs.h"
+#include "estimate.h"
+
+const size_t coarsest_refine_step = 16;
+
+//writes every step'th pixel of each step'th row as its own small png next to where the final image will go
+void write_preview(const uint32_t* pixels, const float* iterations, size_t img_width, size_t img_height, size_t step, const char* filename_base) {
+    size_t preview_width = (img_width + step - 1) / step;
+    size_t preview_height = (img_height + step - 1) / step;
+    auto* preview = new uint32_t[preview_width * preview_height];
+    for (size_t y = 0; y < preview_height; y++)
+        for (size_t x = 0; x < preview_width; x++)
+            preview[y * preview_width + x] = iteration_colour(load_index(pixels, iterations, y * step * img_width + x * step));
 
-typedef struct thread_args {
-    size_t num_threads;
-    size_t thread_num; //[0, num_threads - 1]
-    size_t max_itrs;
-    size_t img_width;
-    size_t img_height;
-    complex_t left_top;
-    complex_t right_bottom;
-//    complex_t* grid;
-    uint32_t* pixels;
-} thread_args;
+    char* filename;
+    asprintf(&filename, "%s (preview %zu).png", filename_base, step);
+    lodepng_encode32_file(filename, (unsigned char*) preview, preview_width, preview_height);
+    printf("Wrote preview %s\n", filename);
+    free(filename);
+    delete[] preview;
+}
 
-int compute_fractal(void* args);
+//raw RGBA frames on stdout for a viewer to read, of the view given or of each "C1x C1y C2x C2y" line on stdin,
+//with a line about each frame on stderr
+int stream_previews(bool from_stdin, complex_t left_top, complex_t right_bottom, size_t img_width, size_t img_height,
+                    size_t max_itrs, thread_pool& pool) {
+    auto* pixels = new uint32_t[img_width * img_height];
+    preview_request request{left_top, right_bottom, img_width, img_height, max_itrs, pixels};
+    char line[512];
+    for (size_t frame = 0; !from_stdin || fgets(line, sizeof(line), stdin); frame++) {
+        double coords[4];
+        if (from_stdin) {
+            if (sscanf(line, "%lf %lf %lf %lf", &coords[0], &coords[1], &coords[2], &coords[3]) != 4) {
+                fprintf(stderr, "Skipping %s", line);
+                continue;
+            }
+            request.left_top = {coords[0], coords[1]};
+            request.right_bottom = {coords[2], coords[3]};
+        }
+        preview_stats stats{};
+        render_preview(request, pool, stats);
+        fwrite(pixels, sizeof(uint32_t), img_width * img_height, stdout);
+        fflush(stdout);
+        fprintf(stderr, "Frame %zu in %.2f ms, %s, %zu iteration cap, %zu iterations\n", frame, stats.wall * 1e3,
+                stats.single_precision ? "float" : "double", stats.itrs_cap, stats.itrs);
+        if (!from_stdin)
+            break;
+    }
+    delete[] pixels;
+    return 0;
+}
 
 int check_argc_range(size_t i, size_t val, int argc, char const* option) {
     if (i + val >= argc) {
@@ -43,6 +99,35 @@ int main(int argc, char** argv) {
     size_t max_itrs = 1500;
     size_t img_width = 16384;
     size_t img_height = 16384;
+    double aa_threshold = 0; //0 means no anti-aliasing
+    size_t aa_samples = 4;
+    bool auto_itrs = false;
+    double auto_itrs_target = 0.001; //fraction of escaping samples allowed to still be escaping past the chosen limit
+    bool progressive = false;
+    bool previews = false;
+    const char* save_path = nullptr;
+    const char* continue_path = nullptr;
+    const char* from_path = nullptr;
+    itr_plane_type save_plane = itr_plane_float;
+    itr_compression save_compression = itr_compress_none;
+    const char* sequence_path = nullptr;
+    size_t sequence_frames = 0;
+    const char* metrics_path = nullptr;
+    const char* trace_path = nullptr;
+    size_t trace_events = default_trace_events; //per thread
+    const char* serve_path = nullptr;
+    const char* batch_path = nullptr;
+    size_t serve_cache_mb = default_serve_cache_mb;
+    size_t thread_count = 0; //0 picks from the affinity mask and cgroup quota
+    bool pin_threads = false;
+    bool pipelined = false;
+    bool bitmap = false;
+    bool tile_costs = false;
+    bool estimate_only = false;
+    bool histogram_colour = false;
+    bool preview = false;
+    bool views_on_stdin = false;
+    bool width_given = false, height_given = false; //previews have their own default size
 
     complex_t left_top{-2, 1.5};
     complex_t right_bottom{1, -1.5};
@@ -56,12 +141,10 @@ int main(int argc, char** argv) {
             img_width = strtoull(argv[2], nullptr, 10);
             img_height = strtoull(argv[3], nullptr, 10);
 
-            double top_left_real = strtod(argv[4], nullptr);
-            double top_left_img = strtod(argv[5], nullptr);
-            double bottom_right_real = strtod(argv[6], nullptr);
-            double bottom_right_img = strtod(argv[7], nullptr);
-            const complex_t::value_type delta_real = (bottom_right_real - top_left_real) / img_width;
-            const complex_t::value_type delta_img = (top_left_img - bottom_right_img) / img_height;
+            //the view's own corner rather than the default one, through the same mapping the kernels use
+            view_map<complex_t::value_type> const view(strtod(argv[4], nullptr), strtod(argv[5], nullptr),
+                                                       strtod(argv[6], nullptr), strtod(argv[7], nullptr), img_width,
+                                                       img_height);
 
             //todo: these *should* really be error checked
             double x1 = strtod(argv[8], nullptr);
@@ -69,18 +152,32 @@ int main(int argc, char** argv) {
             double x2 = strtod(argv[10], nullptr);
             double y2 = strtod(argv[11], nullptr);
 
-            complex_t first = complex_t{left_top.real() + x1 * delta_real, left_top.imag() - y1 * delta_img};
-            complex_t second = complex_t{left_top.real() + x2 * delta_real, left_top.imag() - y2 * delta_img};
+            complex_t first = complex_t{view.real_at(x1), view.imag_at(y1)};
+            complex_t second = complex_t{view.real_at(x2), view.imag_at(y2)};
             printf("Pixels (%.2f, %.2f), and (%.2f, %.2f) at image width and height (%zu, %zu) are at (%.10f, %+.10f) and (%.10f, %+.10f)\n", x1, y1, x2, y2,
                    img_width, img_height,
                    first.real(), first.imag(),
                    second.real(), second.imag());
             return 0;
-        } else {
-            if (argc < 5) {
-                std::cout << "Please enter 4 co-ords" << std::endl;
-                return 0;
+        } else if (strcmp(argv[1], "-map") == 0) {
+            if (argc < 8) {
+                fprintf(stderr, "Streaming pixel to co-ord mapping requires width height left_top_x left_top_y bottom_right_x bottom_right_y [-inverse] [-long], then takes \"x y\" lines on stdin\n");
+                return 1;
             }
+            bool to_pixels = false, extended = false;
+            for (int i = 8; i < argc; i++) {
+                if (strcmp(argv[i], "-inverse") == 0) {
+                    to_pixels = true;
+                } else if (strcmp(argv[i], "-long") == 0) {
+                    extended = true;
+                } else {
+                    fprintf(stderr, "Unknown -map option %s\n", argv[i]);
+                    return 1;
+                }
+            }
+            return stream_view_map(argv + 4, strtoull(argv[2], nullptr, 10), strtoull(argv[3], nullptr, 10), to_pixels,
+                                   extended, STDIN_FILENO, stdout);
+        } else {
             size_t i = 1;
             size_t coords_added = 0;
             complex_t::value_type coords[4];
@@ -88,29 +185,195 @@ int main(int argc, char** argv) {
                 if (strcmp(argv[i], "-i") == 0) {
                     if (check_argc_range(i, 1, argc, "i"))
                         return 1;
-                    max_itrs = strtoull(argv[i + 1], nullptr, 0);
+                    if (strcmp(argv[i + 1], "auto") == 0)
+                        auto_itrs = true;
+                    else
+                        max_itrs = strtoull(argv[i + 1], nullptr, 0);
+                    i += 2;
+                    continue;
+                } else if (strcmp(argv[i], "-it") == 0) {
+                    if (check_argc_range(i, 1, argc, "it"))
+                        return 1;
+                    auto_itrs_target = strtod(argv[i + 1], nullptr);
                     i += 2;
                     continue;
                 } else if (strcmp(argv[i], "-w") == 0) {
                     if (check_argc_range(i, 1, argc, "w"))
                         return 1;
                     img_width = strtoull(argv[i + 1], nullptr, 0);
+                    width_given = true;
                     i += 2;
                     continue;
                 } else if (strcmp(argv[i], "-h") == 0) {
                     if (check_argc_range(i, 1, argc, "h"))
                         return 1;
                     img_height = strtoull(argv[i + 1], nullptr, 0);
+                    height_given = true;
+                    i += 2;
+                    continue;
+                } else if (strcmp(argv[i], "-a") == 0) {
+                    if (check_argc_range(i, 1, argc, "a"))
+                        return 1;
+                    aa_threshold = strtod(argv[i + 1], nullptr);
+                    i += 2;
+                    continue;
+                } else if (strcmp(argv[i], "-as") == 0) {
+                    if (check_argc_range(i, 1, argc, "as"))
+                        return 1;
+                    aa_samples = strtoull(argv[i + 1], nullptr, 0);
+                    if (aa_samples == 0)
+                        aa_samples = 1;
+                    i += 2;
+                    continue;
+                } else if (strcmp(argv[i], "-r") == 0) {
+                    progressive = true;
+                    i++;
+                    continue;
+                } else if (strcmp(argv[i], "-rp") == 0) {
+                    progressive = true;
+                    previews = true;
+                    i++;
+                    continue;
+                } else if (strcmp(argv[i], "-save") == 0) {
+                    if (check_argc_range(i, 1, argc, "save"))
+                        return 1;
+                    save_path = argv[i + 1];
+                    i += 2;
+                    continue;
+                } else if (strcmp(argv[i], "-savez") == 0) {
+                    save_compression = itr_compress_deflate;
+                    i++;
+                    continue;
+                } else if (strcmp(argv[i], "-saveu") == 0) {
+                    save_plane = itr_plane_uint32;
+                    i++;
+                    continue;
+                } else if (strcmp(argv[i], "-from") == 0) {
+                    if (check_argc_range(i, 1, argc, "from"))
+                        return 1;
+                    from_path = argv[i + 1];
+                    i += 2;
+                    continue;
+                } else if (strcmp(argv[i], "-continue") == 0) {
+                    if (check_argc_range(i, 1, argc, "continue"))
+                        return 1;
+                    continue_path = argv[i + 1];
+                    i += 2;
+                    continue;
+                } else if (strcmp(argv[i], "-t") == 0) {
+                    if (check_argc_range(i, 1, argc, "t"))
+                        return 1;
+                    thread_count = strtoull(argv[i + 1], nullptr, 0);
+                    i += 2;
+                    continue;
+                } else if (strcmp(argv[i], "-pin") == 0) {
+                    pin_threads = true;
+                    i++;
+                    continue;
+                } else if (strcmp(argv[i], "-bmp") == 0) {
+                    bitmap = true;
+                    i++;
+                    continue;
+                } else if (strcmp(argv[i], "-hist") == 0) {
+                    histogram_colour = true;
+                    i++;
+                    continue;
+                } else if (strcmp(argv[i], "--estimate") == 0) {
+                    estimate_only = true;
+                    i++;
+                    continue;
+                } else if (strcmp(argv[i], "-preview") == 0) {
+                    preview = true;
+                    i++;
+                    continue;
+                } else if (strcmp(argv[i], "-pipe") == 0) {
+                    pipelined = true;
+                    i++;
+                    continue;
+                } else if (strcmp(argv[i], "--trace") == 0) {
+                    if (check_argc_range(i, 1, argc, "trace"))
+                        return 1;
+                    trace_path = argv[i + 1];
+                    i += 2;
+                    continue;
+                } else if (strcmp(argv[i], "-trace-events") == 0) {
+                    if (check_argc_range(i, 1, argc, "trace-events"))
+                        return 1;
+                    trace_events = strtoull(argv[i + 1], nullptr, 0);
                     i += 2;
                     continue;
+                } else if (strcmp(argv[i], "-tilecosts") == 0) {
+                    tile_costs = true;
+                    i++;
+                    continue;
+                } else if (strcmp(argv[i], "-perf") == 0) {
+                    perf_counters_set_enabled(true);
+                    i++;
+                    continue;
+                } else if (strcmp(argv[i], "-nohuge") == 0) {
+                    big_alloc_set_huge_pages(false);
+                    i++;
+                    continue;
+                } else if (strcmp(argv[i], "--metrics-json") == 0) {
+                    if (check_argc_range(i, 1, argc, "metrics-json"))
+                        return 1;
+                    metrics_path = argv[i + 1];
+                    i += 2;
+                    continue;
+                } else if (strcmp(argv[i], "--serve") == 0) {
+                    if (check_argc_range(i, 1, argc, "serve"))
+                        return 1;
+                    serve_path = argv[i + 1];
+                    i += 2;
+                    continue;
+                } else if (strcmp(argv[i], "-batch") == 0) {
+                    if (check_argc_range(i, 1, argc, "batch"))
+                        return 1;
+                    batch_path = argv[i + 1];
+                    i += 2;
+                    continue;
+                } else if (strcmp(argv[i], "-cache") == 0) {
+                    if (check_argc_range(i, 1, argc, "cache"))
+                        return 1;
+                    serve_cache_mb = strtoull(argv[i + 1], nullptr, 0);
+                    i += 2;
+                    continue;
+                } else if (strcmp(argv[i], "-seq") == 0) {
+                    if (check_argc_range(i, 2, argc, "seq"))
+                        return 1;
+                    sequence_path = argv[i + 1];
+                    sequence_frames = strtoull(argv[i + 2], nullptr, 0);
+                    i += 3;
+                    continue;
                 } else {
+                    if (coords_added == 4) {
+                        std::cout << "Please enter 4 co-ords" << std::endl;
+                        return 2;
+                    }
                     coords[coords_added] = strtod(argv[i], nullptr);
                     coords_added++;
                     i++;
                 }
             }
 
-            if (4 > coords_added) {
+            if (serve_path) {
+                if (coords_added != 0)
+                    std::cout << "Ignoring co-ords, jobs sent to " << serve_path << " set the views" << std::endl;
+            } else if (batch_path) {
+                if (coords_added != 0)
+                    std::cout << "Ignoring co-ords, the jobs in " << batch_path << " set the views" << std::endl;
+            } else if (continue_path) {
+                if (coords_added != 0)
+                    std::cout << "Ignoring co-ords, continuing from " << continue_path << std::endl;
+            } else if (from_path) {
+                if (coords_added != 0)
+                    std::cout << "Ignoring co-ords, colouring " << from_path << std::endl;
+            } else if (sequence_path) {
+                if (coords_added != 0)
+                    std::cout << "Ignoring co-ords, the keyframes in " << sequence_path << " set the views" << std::endl;
+            } else if (preview && coords_added == 0) {
+                views_on_stdin = true;
+            } else if (4 > coords_added) {
                 std::cout << "Please enter 4 co-ords" << std::endl;
                 return 2;
             } else {
@@ -119,48 +382,115 @@ int main(int argc, char** argv) {
             }
         }
     } else {
-        std::cout << "FractalFun C1x C1y C2x C2y [-p P1x P1y P2x P2y | [-i itrs] [-w width] [-h height]]" << std::endl;
+        std::cout << "FractalFun -p width height C1x C1y C2x C2y P1x P1y P2x P2y | -map width height C1x C1y C2x C2y [-inverse] [-long] | C1x C1y C2x C2y [[-i itrs|auto] [-it auto_target] [-w width] [-h height] [-a aa_threshold] [-as aa_samples] [-r | -rp | -pipe] [-bmp] [-hist] [-tilecosts] [--estimate] [-save file [-savez] [-saveu]] [--metrics-json file]] [-t threads] [-pin] [-nohuge] [-perf] [--trace file [-trace-events n]] | -continue file [-i itrs] [-a ...] [-save file] | -from file [-bmp]  | -seq keyframe_file frames [-i itrs] [-w width] [-h height] | --serve socket [-cache MiB] [-t threads] | -batch job_file [-i itrs] [-w width] [-h height] [-t threads] | -preview [C1x C1y C2x C2y] [-i max_itrs] [-w width] [-h height] [-t threads]" << std::endl;
 //        return 0;
     }
 
-    struct timespec start{};
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
-
-    const size_t num_threads = sysconf(_SC_NPROCESSORS_CONF); //very POSIX specific
-
-//    auto grid = new complex_t[img_height * img_width];
-    auto pixels = new uint32_t[img_height * img_width]; //exit() is our garbage collector for this one
-
-    auto* args = new thread_args[num_threads];
-    auto* thread_ids = new thrd_t[num_threads - 1];
+    //the metrics get stdout to themselves, so everything else printed goes to stderr until they're written
+    int metrics_stdout = -1;
+    if (!preview && metrics_path && strcmp(metrics_path, "-") == 0) {
+        fflush(stdout);
+        metrics_stdout = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
 
-    for (size_t i = 0; i < num_threads; i++) {
-        args[i] = {num_threads, i, max_itrs, img_width, img_height, left_top, right_bottom, /*grid,*/ pixels};
-        if (i != 0) { //Using the main thread to do the first pool after
-            thrd_t id;
-            if (thrd_create(&id, &compute_fractal, args + i) == thrd_error) {
-                fprintf(stderr, "Failed to create thread num %zu, exiting\n", i);
-                exit(1);
-            }
-            thread_ids[i - 1] = id;
+    //before the pool so its threads are named in the trace
+    if (trace_path && !preview)
+        trace_start(trace_events);
+    renderer r(thread_count, pin_threads);
+    thread_pool& pool = r.pool();
+    size_t const num_threads = pool.size();
+    //stdout is for frames when previewing
+    fprintf(preview ? stderr : stdout, "Using %zu threads%s\n", num_threads, pool.pinned() ? ", pinned" : "");
+
+    if (preview)
+        return stream_previews(views_on_stdin, left_top, right_bottom, width_given ? img_width : default_preview_width,
+                               height_given ? img_height : default_preview_height, max_itrs, pool);
+
+    if (serve_path || batch_path || sequence_path) {
+        //these only change a single render, which none of the three modes go through
+        if (aa_threshold > 0 || histogram_colour || bitmap || pipelined || progressive || auto_itrs || save_path
+            || estimate_only || metrics_path || tile_costs) {
+            std::cout << (serve_path ? "--serve" : batch_path ? "-batch" : "-seq")
+                      << " can't be used with -a, -hist, -bmp, -pipe, -r, -i auto, -save, --estimate, --metrics-json or -tilecosts"
+                      << std::endl;
+            return 1;
         }
+        int const status = serve_path ? serve(serve_path, pool, serve_cache_mb)
+                : batch_path ? render_batch(batch_path, max_itrs, img_width, img_height, r)
+                : render_sequence(sequence_path, sequence_frames, max_itrs, img_width, img_height, pool);
+        if (trace_path)
+            write_trace_json(trace_path);
+        return status;
     }
-    compute_fractal(args);
-
-    for (size_t i = 0; i < num_threads - 1; i++)
-        thrd_join(thread_ids[i], nullptr);
 
-//    delete[] grid;
-    delete[] thread_ids;
-    delete[] args;
+    if (continue_path && (auto_itrs || progressive || tile_costs)) {
+        //continuing isn't tiled, so there would be no tile costs to speak of
+        std::cout << "-i auto, -r and -tilecosts can't be used when continuing" << std::endl;
+        return 1;
+    }
+    if (from_path && (continue_path || progressive || auto_itrs || aa_threshold > 0 || save_path || pipelined
+                      || tile_costs || histogram_colour)) {
+        std::cout << "-from can't be used with -continue, -r, -i auto, -a, -save, -pipe, -tilecosts or -hist" << std::endl;
+        return 1;
+    }
+    if (estimate_only && (continue_path || from_path)) {
+        std::cout << "--estimate is for new renders, not -continue or -from" << std::endl;
+        return 1;
+    }
+    if (!save_path && (save_compression != itr_compress_none || save_plane != itr_plane_float)) {
+        std::cout << "-savez and -saveu only change how -save writes, so they need -save" << std::endl;
+        return 1;
+    }
+    if (pipelined && (continue_path || progressive || aa_threshold > 0 || save_path || bitmap || histogram_colour)) {
+        //each of these needs every pixel computed before it can start, and the pipeline only encodes png
+        std::cout << "-pipe can't be used with -continue, -r, -a, -save, -bmp or -hist" << std::endl;
+        return 1;
+    }
 
-    struct timespec stop{};
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stop);
-    double result = ((stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9) / num_threads;
-    printf("Time taken on fractal: %f\n", result);
+    render_spec spec{left_top, right_bottom, img_width, img_height, max_itrs, aa_threshold, aa_samples, false,
+                     save_path != nullptr, tile_costs, histogram_colour};
+    timing_point render_start = timing_now();
+    //continuing and colouring take the view and size from the file
+    if (continue_path) {
+        if (r.prepare_continue(continue_path, spec))
+            return 1;
+    } else if (from_path) {
+        if (r.prepare_from(from_path, spec))
+            return 1;
+        const itr_file_map& source = *r.from_file();
+        printf("Colouring %s, %s of %s rendered in %s, %s tiles of %upx\n", from_path,
+               source.header.plane_type == itr_plane_float ? "continuous indices" : "whole iterations", source.formula,
+               source.precision, source.header.compression == itr_compress_deflate ? "deflated" : "stored",
+               source.header.tile_size);
+    }
+    img_width = spec.img_width;
+    img_height = spec.img_height;
+    left_top = spec.left_top;
+    right_bottom = spec.right_bottom;
+
+    if (bitmap && !bmp_fits(img_width, img_height)) {
+        printf("%zupx x %zupx is too big for a bitmap, which has to be under 4 GiB, leave out -bmp to write a png\n",
+               img_width, img_height);
+        return 1;
+    }
 
-    printf("starting image write, please wait for finish\n");
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    if (auto_itrs)
+        spec.max_itrs = choose_max_itrs(left_top, right_bottom, auto_itrs_target, pool);
+    max_itrs = spec.max_itrs;
+
+    if (estimate_only) {
+        //nothing is allocated or written, so a render that wouldn't fit can still be asked about
+        render_estimate estimate{};
+        double const estimate_start = wall_now();
+        estimate_render(spec, pipelined, bitmap, pool, estimate);
+        printf("Estimated %zupx x %zupx at %zu iterations in %f\n", img_width, img_height, max_itrs,
+               wall_now() - estimate_start);
+        print_estimate(estimate, num_threads);
+        if (trace_path)
+            write_trace_json(trace_path);
+        return 0;
+    }
 
     struct stat statbuf{};
     if (stat(type_name, &statbuf) != -1) {
@@ -172,78 +502,138 @@ int main(int argc, char** argv) {
         mkdir(type_name, S_IRWXU | S_IRWXG | S_IRWXO);
     }
 
-    char* filename;
-    asprintf(&filename, "%s/(%.10f, %+.10f)-(%.10f, %+.10f) (%zu itr) (%zupx x %zupx).png", type_name, real(left_top),
+    char* filename_base;
+    asprintf(&filename_base, "%s/(%.10f, %+.10f)-(%.10f, %+.10f) (%zu itr) (%zupx x %zupx)", type_name, real(left_top),
              imag(left_top), real(right_bottom), imag(right_bottom), max_itrs, img_width, img_height);
-    lodepng_encode32_file(filename, (unsigned char*) pixels, img_width, img_height);
-//    generateBitmapImage(pixels, img_height, img_width, filename);
-    free(filename);
 
-    printf("image write finished\n");
+    char* filename;
+    asprintf(&filename, "%s.%s", filename_base, bitmap ? "bmp" : "png");
 
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stop);
-    result = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
-    printf("Time taken on image write: %f\n", result);
+    if (!continue_path && !from_path) {
+        render_start = timing_now();
+        if (r.prepare(spec))
+            return 1;
+    }
+    stage_times& times = r.times();
+
+    size_t bytes_written = 0;
+    if (continue_path) {
+        r.compute_continue();
+        printf("Continued %zu unescaped pixels from %zu to %zu iterations\n",
+               (size_t) r.continued_header().num_unescaped, (size_t) r.continued_header().max_itrs, max_itrs);
+    } else if (progressive) {
+        double level_start = wall_now();
+        r.compute_progressive(coarsest_refine_step, [&](size_t step) {
+            printf("Refinement level %zu done after %f\n", step, wall_now() - level_start);
+            if (previews && step > 1)
+                write_preview(r.pixels(), r.iterations(), img_width, img_height, step, filename_base);
+            level_start = wall_now();
+        });
+    } else if (from_path) {
+        //the file's tiles are coloured in place of the usual colour pass below
+    } else if (pipelined) {
+        //colouring and writing the image happen in here too, a band at a time as the rows finish
+        pipeline_result piped{};
+        if (r.compute_pipelined(filename, piped) != 0)
+            return 1;
+        bytes_written = piped.bytes_written;
+        printf("Pipelined %zu bands through compute, filter, deflate and write in %f\n", piped.bands,
+               times.wall[stage_pipeline]);
+    } else {
+        r.compute();
+    }
+    //colouring from a file has no compute pass, so there are no compute threads to report
+    std::vector<thread_stats> compute_threads;
+    if (!from_path) {
+        pool.print_stats(stage_names[pipelined ? stage_pipeline : stage_compute], true);
+        for (size_t i = 0; i < num_threads; i++)
+            compute_threads.push_back(pool.stats_for(i));
+    }
 
-    return 0;
-}
+    std::vector<thread_stats> colour_threads;
+    if (!pipelined) {
+        r.colour();
+        pool.print_stats(stage_names[stage_colour], false);
+        for (size_t i = 0; i < num_threads; i++)
+            colour_threads.push_back(pool.stats_for(i));
+    }
 
-int compute_fractal(void* args) {
-    size_t const thread_num = ((thread_args*) args)->thread_num;
-    size_t const num_threads = ((thread_args*) args)->num_threads;
-    size_t const max_itrs = ((thread_args*) args)->max_itrs;
-    size_t const img_width = ((thread_args*) args)->img_width;
-    size_t const img_height = ((thread_args*) args)->img_height;
-
-    complex_t const left_top = ((thread_args*) args)->left_top;
-    complex_t const right_bottom = ((thread_args*) args)->right_bottom;
-    const complex_t::value_type delta_real = (right_bottom.real() - left_top.real()) / img_width;
-    const complex_t::value_type delta_img = (left_top.imag() - right_bottom.imag()) / img_height;
-
-//    complex_t* grid = ((thread_args*) args)->grid;
-    auto* pixels = ((thread_args*) args)->pixels;
-//    printf("id: %zu, num_threads: %zu, delta_img: %f, delta_real: %f\n", thread_num, num_threads, delta_img, delta_real);
-
-//    for (size_t y = thread_num; y < img_height; y += num_threads) {
-//        complex_t y_val = complex_t{0, left_top.imag() - y * delta_img};
-//
-//        for (size_t x = 0; x < img_width; x++) {
-//            complex_t x_val = complex_t{left_top.real() + x * delta_real, 0};
-//            grid[y * img_width + x] = x_val + y_val;
-//        }
-//    }
-
-    for (size_t y = thread_num; y < img_height; y += num_threads) {
-        for (size_t x = 0; x < img_width; x++) {
-            complex_t z = complex_t{0, 0};
-            complex_t c = complex_t{left_top.real() + x * delta_real, left_top.imag() - y * delta_img}; //grid[y * img_width + x];
-//            std::cout << c << "\n";
-            bool broke = false;
-            size_t itr;
-            for (itr = 0; itr < max_itrs; itr++) {
-//                z = conj(z) * conj(z) + c; //tricorn
-
-                z = z * z + c; //Mandelbrot
-                if (norm(z) > (4)) {
-                    broke = true;
-                    break;
-                }
-            }
-            if (!broke) {
-                pixels[y * img_width + x] = inside_colour.packed();
-//                grid[y * img_width + x] = 0 + -1 * I; //values inside_colour the set should not affect colourings of those outside
-                continue;
-            }
+    if (aa_threshold > 0) {
+        r.antialias();
+        pool.print_stats(stage_names[stage_antialias], false);
+        size_t const refined = r.totals().aa_refined;
+        printf("Anti-aliasing refined %zu of %zu pixels (%.2f%%) with %zu samples each\n", refined, img_width * img_height,
+               100.0 * refined / (img_width * img_height), aa_samples * aa_samples);
+    }
+
+    if (tile_costs)
+        write_tile_costs(filename_base, r.tile_costs(), r.tile_grid(), left_top, right_bottom, img_width, img_height,
+                         max_itrs);
+
+    if (save_path && r.save(save_path, save_plane, save_compression) == 0)
+        printf("Saved iteration state with %zu unescaped pixels to %s\n", r.unescaped_count(), save_path);
 
-            double continuous_index = itr + 1 - (log(2) / abs(z)) / log(2);
-            uint8_t red =   ((sin(0.058 * continuous_index + 4) + 1) * (230 / 2.0) + 25);
-            uint8_t green = ((sin(0.0565* continuous_index + 2) + 1) * (230 / 2.0) + 25);
-            uint8_t blue =  ((sin(0.055 * continuous_index + 1) + 1) * (230 / 2.0) + 25);
-            uint8_t alpha = 255;
-            Colour colour{red, green, blue, alpha};
-            pixels[y * img_width + x] = colour.packed();
+    counter_values encode_counters{};
+    if (!pipelined) {
+        double const fractal_wall = times.wall[stage_compute] + times.wall[stage_colour] + times.wall[stage_antialias];
+        printf("Time taken on fractal: %f\n", fractal_wall);
+
+        printf("starting image write, please wait for finish\n");
+
+        output_method method;
+        counter_values const encode_start = thread_counters_now();
+        if (bitmap) {
+            r.encode_bmp(filename, bmp_rgba, bytes_written, method);
+        } else {
+            unsigned error = r.encode_png(filename, bytes_written, method);
+            if (error)
+                fprintf(stderr, "Failed to write %s: %s\n", filename, lodepng_error_text(error));
         }
+        counters_add(encode_counters, encode_start, thread_counters_now());
+
+        printf("image write finished, with %s\n", output_method_names[method]);
+        print_counters("encode counters", encode_counters);
+
+        double const write_wall = times.wall[stage_filter] + times.wall[stage_deflate] + times.wall[stage_write];
+        printf("Time taken on image write: %f\n", write_wall);
+    } else {
+        printf("Stages overlapped, so their times below are summed over threads, the pipeline's is the elapsed time\n");
     }
-//    printf("id: %zu min: %f, max: %f\n", thread_num, min_esc_thr[thread_num], max_esc_thr[thread_num]);
+
+    const render_totals& totals = r.totals();
+    print_stage_times(times);
+    double const total_wall = wall_now() - render_start.wall;
+    printf("Total wall time: %f\n", total_wall);
+    double const compute_wall = pipelined ? times.wall[stage_pipeline]
+            : from_path ? times.wall[stage_colour] : times.wall[stage_compute];
+    printf("Throughput: %.3f Mpixels/s, %.3f Giterations/s computing, %.3f MB/s written (%zu bytes)\n",
+           img_width * img_height / compute_wall * 1e-6, totals.itrs / compute_wall * 1e-9,
+           times.wall[stage_write] > 0 ? bytes_written / times.wall[stage_write] * 1e-6 : 0.0, bytes_written);
+    printf("Pixels: %zu escaped, %zu interior (%zu by shortcut)\n", img_width * img_height - totals.interior_pixels,
+           totals.interior_pixels, totals.shortcuts);
+    printf("Tiles: %zu of %zupx in %zu bands, %zu taken from another thread's band over all passes\n",
+           r.tile_grid().columns() * r.tile_grid().rows(), r.tile_grid().size(), num_threads, totals.tiles_stolen);
+    big_alloc_stats const allocs = big_alloc_totals();
+    printf("Big allocations: %.1f MiB on explicit huge pages, %.1f MiB advised transparent, %.1f MiB small pages\n",
+           allocs.explicit_huge_bytes / 1048576.0, allocs.transparent_huge_bytes / 1048576.0, allocs.small_page_bytes / 1048576.0);
+
+    if (metrics_path) {
+        render_metrics metrics{left_top, right_bottom, img_width, img_height, max_itrs, auto_itrs, num_threads,
+                               aa_threshold, aa_samples, progressive, continue_path, total_wall, totals.itrs,
+                               totals.interior_pixels, totals.shortcuts, totals.aa_refined, compute_threads,
+                               colour_threads, perf_counters_enabled(), encode_counters, filename, bytes_written};
+        if (metrics_stdout != -1) {
+            std::cout.flush();
+            fflush(stdout);
+            dup2(metrics_stdout, STDOUT_FILENO);
+            close(metrics_stdout);
+        }
+        write_metrics_json(metrics_path, metrics, times);
+    }
+    if (trace_path)
+        write_trace_json(trace_path);
+    free(filename);
+    free(filename_base);
+
     return 0;
 }
@@ -0,0 +1,124 @@
+#include "metrics.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/resource.h>
+
+#include "big_alloc.h"
+
+static void write_json_string(FILE* out, const char* str) {
+    fputc('"', out);
+    for (const char* c = str; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            fprintf(out, "\\%c", *c);
+        else if ((unsigned char) *c < 0x20)
+            fprintf(out, "\\u%04x", *c);
+        else
+            fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+//json has no nan or infinity, so those are written as null
+typedef struct json_double {
+    char text[64];
+} json_double;
+
+static json_double to_json(double value, const char* format) {
+    json_double number{};
+    if (std::isfinite(value))
+        snprintf(number.text, sizeof(number.text), format, value);
+    else
+        snprintf(number.text, sizeof(number.text), "null");
+    return number;
+}
+
+static void write_threads_json(FILE* out, const std::vector<thread_stats>& threads, bool counted) {
+    for (size_t i = 0; i < threads.size(); i++) {
+        fprintf(out, "%s{\"busy_wall\": %s, \"busy_cpu\": %s", i ? ", " : "",
+                to_json(threads[i].busy_wall, "%.9f").text, to_json(threads[i].busy_cpu, "%.9f").text);
+        if (counted) {
+            fprintf(out, ", \"counters\": ");
+            write_counters_json(out, threads[i].counters);
+        }
+        fputc('}', out);
+    }
+}
+
+int write_metrics_json(const char* path, const render_metrics& metrics, const stage_times& times) {
+    bool const to_stdout = strcmp(path, "-") == 0;
+    FILE* out = to_stdout ? stdout : fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Could not open %s for the metrics\n", path);
+        return 1;
+    }
+
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    big_alloc_stats const allocs = big_alloc_totals();
+    size_t const pixels = metrics.img_width * metrics.img_height;
+    size_t const raw_bytes = pixels * 4;
+
+    fprintf(out, "{\n  \"version\": 1,\n  \"type\": ");
+    write_json_string(out, type_name);
+    fprintf(out, ",\n  \"params\": {\"left_top\": [%s, %s], \"right_bottom\": [%s, %s], "
+                 "\"width\": %zu, \"height\": %zu, \"max_itrs\": %zu, \"auto_itrs\": %s, \"threads\": %zu, "
+                 "\"aa_threshold\": %s, \"aa_samples\": %zu, \"progressive\": %s, \"continued_from\": ",
+            to_json(metrics.left_top.real(), "%.17g").text, to_json(metrics.left_top.imag(), "%.17g").text,
+            to_json(metrics.right_bottom.real(), "%.17g").text, to_json(metrics.right_bottom.imag(), "%.17g").text,
+            metrics.img_width, metrics.img_height, metrics.max_itrs, metrics.auto_itrs ? "true" : "false",
+            metrics.num_threads, to_json(metrics.aa_threshold, "%.17g").text, metrics.aa_samples,
+            metrics.progressive ? "true" : "false");
+    if (metrics.continued_from)
+        write_json_string(out, metrics.continued_from);
+    else
+        fprintf(out, "null");
+    fprintf(out, "},\n  \"stages\": {");
+
+    bool first = true;
+    for (size_t stage = 0; stage < num_stages; stage++) {
+        if (!times.used[stage])
+            continue;
+        fprintf(out, "%s\"%s\": {\"wall\": %s, \"cpu\": %s, \"minor_faults\": %zu, \"major_faults\": %zu, "
+                     "\"bytes_copied\": %zu}", first ? "" : ", ", stage_names[stage],
+                to_json(times.wall[stage], "%.9f").text, to_json(times.cpu[stage], "%.9f").text,
+                times.minor_faults[stage], times.major_faults[stage], times.bytes_copied[stage]);
+        first = false;
+    }
+
+    fprintf(out, "},\n  \"total_wall\": %s,\n  \"pixels\": %zu,\n  \"iterations\": %zu,\n  \"escaped_pixels\": %zu,\n"
+                 "  \"interior_pixels\": %zu,\n  \"shortcut_rejections\": %zu,\n  \"aa_refined_pixels\": %zu,\n"
+                 "  \"peak_rss_bytes\": %zu,\n  \"page_faults\": {\"minor\": %zu, \"major\": %zu},\n"
+                 "  \"big_alloc_bytes\": {\"explicit_huge\": %zu, \"transparent_huge\": %zu, \"small_pages\": %zu},\n"
+                 "  \"output\": {\"path\": ",
+            to_json(metrics.total_wall, "%.9f").text, pixels, metrics.total_itrs, pixels - metrics.interior_pixels,
+            metrics.interior_pixels, metrics.shortcut_rejections, metrics.aa_refined, (size_t) usage.ru_maxrss * 1024,
+            (size_t) usage.ru_minflt, (size_t) usage.ru_majflt, allocs.explicit_huge_bytes,
+            allocs.transparent_huge_bytes, allocs.small_page_bytes);
+    write_json_string(out, metrics.output_path ? metrics.output_path : "");
+    fprintf(out, ", \"bytes\": %zu, \"raw_bytes\": %zu, \"compression_ratio\": %s},\n  \"compute_threads\": [",
+            metrics.output_bytes, raw_bytes,
+            to_json(metrics.output_bytes ? (double) raw_bytes / metrics.output_bytes : 0.0, "%.6f").text);
+    write_threads_json(out, metrics.compute_threads, metrics.counted);
+    fprintf(out, "],\n  \"colour_threads\": [");
+    write_threads_json(out, metrics.colour_threads, metrics.counted);
+    if (metrics.counted) {
+        fprintf(out, "],\n  \"encode_counters\": ");
+        write_counters_json(out, metrics.encode_counters);
+        fprintf(out, "\n}\n");
+    } else {
+        fprintf(out, "]\n}\n");
+    }
+
+    if (to_stdout) {
+        fflush(out);
+        return 0;
+    }
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Failed writing metrics to %s\n", path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef FRACTALFUN_METRICS_H
+#define FRACTALFUN_METRICS_H
+
+#include <cstddef>
+#include <vector>
+
+#include "complex_t.h"
+#include "perf_counters.h"
+#include "thread_pool.h"
+#include "timing.h"
+
+//Everything about a finished render worth tracking between versions and hosts
+typedef struct render_metrics {
+    complex_t left_top;
+    complex_t right_bottom;
+    size_t img_width;
+    size_t img_height;
+    size_t max_itrs;
+    bool auto_itrs;
+    size_t num_threads;
+    double aa_threshold; //0 when anti-aliasing was off
+    size_t aa_samples;
+    bool progressive;
+    const char* continued_from; //null unless continuing
+
+    double total_wall;
+    size_t total_itrs;
+    size_t interior_pixels;
+    size_t shortcut_rejections;
+    size_t aa_refined;
+    std::vector<thread_stats> compute_threads; //empty when colouring from a file, as there was no compute pass
+    std::vector<thread_stats> colour_threads; //empty when pipelined, as colouring happened during compute
+    bool counted; //whether the threads' counters and encode_counters were being counted
+    counter_values encode_counters; //the thread that encoded and wrote the image
+
+    const char* output_path;
+    size_t output_bytes;
+} render_metrics;
+
+//writes the metrics and stage times as a single json object to path, or stdout for "-", returns 0 on success.
+//Doubles that aren't finite are written as null. main keeps stdout for the json alone when it's "-"
+int write_metrics_json(const char* path, const render_metrics& metrics, const stage_times& times);
+
+#endif //FRACTALFUN_METRICS_H
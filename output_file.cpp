@@ -0,0 +1,95 @@
+#include "output_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+const char* const output_method_names[] = {"write", "mmap"};
+
+static bool write_all(int fd, const char* data, size_t size, size_t& offset) {
+    while (size > 0) {
+        //keeping every write but the first and last on a chunk boundary lets the filesystem take whole extents
+        size_t const amount = std::min(size, output_write_chunk - offset % output_write_chunk);
+        uint64_t const write_start = trace_now();
+        ssize_t const written = write(fd, data, amount);
+        trace_span("write", write_start, "bytes", written);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+static int write_streamed(int fd, const output_piece* pieces, size_t num_pieces) {
+    size_t offset = 0;
+    for (size_t i = 0; i < num_pieces; i++)
+        if (!write_all(fd, (const char*) pieces[i].data, pieces[i].size, offset))
+            return 1;
+    return 0;
+}
+
+static int write_mapped(int fd, const output_piece* pieces, size_t num_pieces, size_t total, output_method& method) {
+    //allocating every block up front means a full disk fails here rather than as a SIGBUS halfway through the copy.
+    //A filesystem that can't preallocate gets written to instead, since mapping a sparse file would bring the SIGBUS
+    //back
+    int const allocated = posix_fallocate(fd, 0, total);
+    if (allocated == EOPNOTSUPP || allocated == EINVAL) {
+        method = output_write;
+        return write_streamed(fd, pieces, num_pieces);
+    }
+    if (allocated != 0) {
+        fprintf(stderr, "Could not allocate %zu bytes for the output: %s\n", total, strerror(allocated));
+        return 1;
+    }
+    void* map = mmap(nullptr, total, PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return 1;
+    madvise(map, total, MADV_SEQUENTIAL);
+    char* out = (char*) map;
+    for (size_t i = 0; i < num_pieces; i++) {
+        uint64_t const copy_start = trace_now();
+        memcpy(out, pieces[i].data, pieces[i].size);
+        trace_span("mmap copy", copy_start, "bytes", (int64_t) pieces[i].size);
+        out += pieces[i].size;
+    }
+    uint64_t const unmap_start = trace_now();
+    int const error = munmap(map, total) == 0 ? 0 : 1;
+    trace_span("munmap", unmap_start);
+    return error;
+}
+
+int write_output_file(const char* path, const output_piece* pieces, size_t num_pieces, output_method& method) {
+    size_t total = 0;
+    for (size_t i = 0; i < num_pieces; i++)
+        total += pieces[i].size;
+    method = total >= mmap_output_threshold ? output_mmap : output_write;
+
+    //O_RDWR as a shared mapping needs to be able to read the file too
+    uint64_t const open_start = trace_now();
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    trace_span("open", open_start);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open %s for writing\n", path);
+        return 1;
+    }
+    int error = method == output_mmap ? write_mapped(fd, pieces, num_pieces, total, method)
+            : write_streamed(fd, pieces, num_pieces);
+    uint64_t const close_start = trace_now();
+    if (close(fd) != 0)
+        error = 1;
+    trace_span("close", close_start);
+    if (error)
+        fprintf(stderr, "Failed writing %zu bytes to %s with %s\n", total, path, output_method_names[method]);
+    return error;
+}
@@ -0,0 +1,28 @@
+#ifndef FRACTALFUN_OUTPUT_FILE_H
+#define FRACTALFUN_OUTPUT_FILE_H
+
+#include <cstddef>
+
+//Writes a file out of pieces that are already in memory wherever they were made, so nothing is assembled first.
+//The only copy is the one into the page cache, made by write() or by memcpy into a mapping of the file
+
+typedef struct output_piece {
+    const void* data;
+    size_t size;
+} output_piece;
+
+enum output_method {
+    output_write, //write() in large chunks, each ending on a chunk aligned file offset
+    output_mmap, //the file is preallocated at its final size, mapped and copied into
+};
+
+extern const char* const output_method_names[];
+
+//files at least this big are mapped, below it the mapping costs more to set up and tear down than it saves
+const size_t mmap_output_threshold = (size_t) 64 << 20;
+const size_t output_write_chunk = (size_t) 8 << 20;
+
+//writes the pieces one after another as path, with method set to how, returns 0 on success
+int write_output_file(const char* path, const output_piece* pieces, size_t num_pieces, output_method& method);
+
+#endif //FRACTALFUN_OUTPUT_FILE_H
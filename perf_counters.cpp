@@ -0,0 +1,157 @@
+#include "perf_counters.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char* const counter_names[num_counters] = {"cycles", "instructions", "branch_misses", "cache_misses", "dtlb_misses"};
+
+static std::atomic<bool> counting{false};
+static std::atomic<bool> warned{false};
+
+void perf_counters_set_enabled(bool enabled) {
+    counting = enabled;
+}
+
+bool perf_counters_enabled() {
+    return counting;
+}
+
+static void event_for(counter_id counter, __u32& type, __u64& config) {
+    type = PERF_TYPE_HARDWARE;
+    switch (counter) {
+        case counter_cycles:
+            config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case counter_instructions:
+            config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case counter_branch_misses:
+            config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        case counter_cache_misses:
+            config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        default:
+            type = PERF_TYPE_HW_CACHE;
+            config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+    }
+}
+
+//one fd per counter rather than a group, so a machine that lacks one still gives the rest
+typedef struct thread_counters {
+    int fds[num_counters];
+    bool opened;
+
+    void open_all() {
+        opened = true;
+        int first_error = 0;
+        for (size_t i = 0; i < num_counters; i++) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            event_for((counter_id) i, attr.type, attr.config);
+            //user space only, which is all the kernels do and is allowed at the default paranoid level of 2
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+            if (fds[i] < 0 && !first_error)
+                first_error = errno;
+        }
+        if (first_error && !warned.exchange(true))
+            fprintf(stderr, "Some hardware counters aren't available (%s), they're left out\n", strerror(first_error));
+    }
+
+    ~thread_counters() {
+        if (!opened)
+            return;
+        for (int fd : fds)
+            if (fd >= 0)
+                close(fd);
+    }
+} thread_counters;
+
+static thread_local thread_counters own_counters{{}, false};
+
+counter_values thread_counters_now() {
+    counter_values now{};
+    if (!counting)
+        return now;
+    if (!own_counters.opened)
+        own_counters.open_all();
+    for (size_t i = 0; i < num_counters; i++) {
+        if (own_counters.fds[i] < 0)
+            continue;
+        uint64_t read_values[3]; //value, time enabled, time running
+        if (read(own_counters.fds[i], read_values, sizeof(read_values)) != sizeof(read_values) || read_values[2] == 0)
+            continue;
+        now.value[i] = read_values[2] < read_values[1]
+                ? (uint64_t) ((double) read_values[0] * read_values[1] / read_values[2]) : read_values[0];
+        now.available |= 1u << i;
+    }
+    return now;
+}
+
+void counters_add(counter_values& into, const counter_values& start, const counter_values& stop) {
+    unsigned const both = start.available & stop.available;
+    for (size_t i = 0; i < num_counters; i++)
+        if (both & (1u << i))
+            into.value[i] += stop.value[i] > start.value[i] ? stop.value[i] - start.value[i] : 0;
+    //a counter missing from a later pass would make the total a lie, so it's dropped from then on, even if that
+    //leaves none
+    into.available = into.seeded ? into.available & both : both;
+    into.seeded = true;
+}
+
+void counters_sum(counter_values& into, const counter_values& other) {
+    if (!other.seeded) //nothing was ever added to it, say a thread that got no tasks
+        return;
+    for (size_t i = 0; i < num_counters; i++)
+        into.value[i] += other.value[i];
+    into.available = into.seeded ? into.available & other.available : other.available;
+    into.seeded = true;
+}
+
+static bool has(const counter_values& counters, counter_id counter) {
+    return counters.available & (1u << counter);
+}
+
+void print_counters(const char* label, const counter_values& counters) {
+    if (!counters.available)
+        return;
+    printf("  %s:", label);
+    const char* separator = " ";
+    double const instructions = (double) counters.value[counter_instructions];
+    if (has(counters, counter_cycles) && has(counters, counter_instructions) && counters.value[counter_cycles]) {
+        printf("%s%.2f IPC", separator, instructions / counters.value[counter_cycles]);
+        separator = ", ";
+    }
+    for (size_t i = 0; i < num_counters; i++) {
+        if (!has(counters, (counter_id) i))
+            continue;
+        if (i >= counter_branch_misses && has(counters, counter_instructions) && instructions > 0)
+            printf("%s%.3f %s per 1000 instructions", separator, counters.value[i] * 1e3 / instructions, counter_names[i]);
+        else
+            printf("%s%llu %s", separator, (unsigned long long) counters.value[i], counter_names[i]);
+        separator = ", ";
+    }
+    printf("\n");
+}
+
+void write_counters_json(FILE* out, const counter_values& counters) {
+    fputc('{', out);
+    for (size_t i = 0; i < num_counters; i++) {
+        fprintf(out, "%s\"%s\": ", i ? ", " : "", counter_names[i]);
+        if (has(counters, (counter_id) i))
+            fprintf(out, "%llu", (unsigned long long) counters.value[i]);
+        else
+            fprintf(out, "null");
+    }
+    fputc('}', out);
+}
@@ -0,0 +1,44 @@
+#ifndef FRACTALFUN_PERF_COUNTERS_H
+#define FRACTALFUN_PERF_COUNTERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+enum counter_id {
+    counter_cycles,
+    counter_instructions,
+    counter_branch_misses, //mostly the escape test once the kernel is warm
+    counter_cache_misses, //last level, so what actually goes out to memory
+    counter_dtlb_misses, //data loads only
+    num_counters
+};
+
+extern const char* const counter_names[num_counters];
+
+//hardware event counts, user space only, scaled up when the kernel had to share the counters out
+typedef struct counter_values {
+    uint64_t value[num_counters];
+    unsigned available; //bit per counter_id, a counter the machine or its permissions don't allow stays 0 and unset
+    bool seeded; //for totals, whether anything has been added yet, before which available is whatever comes first
+} counter_values;
+
+//off by default, since opening counters costs a few syscalls per thread and they're often not allowed anyway
+void perf_counters_set_enabled(bool enabled);
+bool perf_counters_enabled();
+
+//the calling thread's counts so far, opening its counters on the first call. With counting off, or nothing the
+//kernel will let us open, nothing is available and a single warning says why
+counter_values thread_counters_now();
+
+//adds stop - start to into, keeping only counters available at both ends and in everything added before
+void counters_add(counter_values& into, const counter_values& start, const counter_values& stop);
+//adds another total to into, the same way, skipping one nothing was added to
+void counters_sum(counter_values& into, const counter_values& other);
+
+//label, then IPC and misses per thousand instructions for whichever counters are available, nothing if none are
+void print_counters(const char* label, const counter_values& counters);
+//a json object of every counter, null for the ones that weren't available
+void write_counters_json(FILE* out, const counter_values& counters);
+
+#endif //FRACTALFUN_PERF_COUNTERS_H
@@ -0,0 +1,334 @@
+#include "pipeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+#include "lodepng/lodepng.h"
+
+#include "big_alloc.h"
+#include "checksums.h"
+#include "tile_scheduler.h"
+#include "trace.h"
+#include "view_map.h"
+
+//a band is one row of tiles, so every tile finishing counts towards exactly one band
+const size_t pipeline_band_rows = default_tile_size;
+
+typedef struct encoded_band {
+    unsigned char* chunk; //the whole IDAT chunk, from lodepng's allocator
+    size_t chunk_size;
+    unsigned adler; //of just this band's filtered scanlines
+    size_t filtered_size;
+} encoded_band;
+
+typedef struct pipeline_state {
+    const thread_args* params;
+    tile_scheduler* tiles;
+    size_t num_bands;
+    std::atomic<size_t>* tiles_left; //per band
+    std::atomic<size_t>* waiting_on; //per band, its own tiles and the band above, whose last row the filters look at
+    encoded_band* encoded;
+    std::atomic<bool>* encode_done;
+
+    mtx_t queue_lock;
+    size_t* queue; //bands ready to encode, each is only pushed once so num_bands is enough room
+    size_t queue_head;
+    size_t queue_tail;
+
+    std::atomic<bool> writing; //one thread writes at a time, the others leave their bands to it
+    std::atomic<size_t> next_write;
+    FILE* file;
+    unsigned adler; //of everything written so far, only touched while writing
+    size_t bytes_written;
+    std::atomic<bool> failed;
+} pipeline_state;
+
+typedef struct pipeline_args {
+    pipeline_state* state;
+    size_t thread_num;
+    sample_counts counts; //out
+    size_t interior_pixels; //out
+    timing_point spent[num_stages]; //out, this thread's share of each stage
+    size_t copied[num_stages]; //out
+} pipeline_args;
+
+static void add_spent(timing_point& spent, timing_point start, timing_point stop) {
+    spent.wall += stop.wall - start.wall;
+    spent.cpu += stop.cpu - start.cpu;
+    spent.minor_faults += stop.minor_faults - start.minor_faults;
+    spent.major_faults += stop.major_faults - start.major_faults;
+}
+
+static void put_be32(unsigned char* out, unsigned value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static void push_band(pipeline_state* state, size_t band) {
+    mtx_lock(&state->queue_lock);
+    state->queue[state->queue_tail++] = band;
+    mtx_unlock(&state->queue_lock);
+}
+
+static bool pop_band(pipeline_state* state, size_t& band) {
+    mtx_lock(&state->queue_lock);
+    bool const found = state->queue_head < state->queue_tail;
+    if (found)
+        band = state->queue[state->queue_head++];
+    mtx_unlock(&state->queue_lock);
+    return found;
+}
+
+static void band_dependency_done(pipeline_state* state, size_t band) {
+    if (state->waiting_on[band].fetch_sub(1) == 1)
+        push_band(state, band);
+}
+
+//same sampling as compute_fractal followed by colour_iterations, just without the index being stored in between
+static void compute_tile(pipeline_args* pargs, const tile_t& tile) {
+    const thread_args& params = *pargs->state->params;
+    size_t const img_width = params.img_width;
+    view_map<complex_t::value_type> const view(params.left_top, params.right_bottom, img_width, params.img_height);
+
+    for (size_t y = tile.y0; y < tile.y1; y++) {
+        for (size_t x = tile.x0; x < tile.x1; x++) {
+            complex_t c = view.point(x, y);
+            float const itr = sample_index(c, params.max_itrs, pargs->counts);
+            pargs->interior_pixels += itr == interior_itr;
+            params.pixels[y * img_width + x] = iteration_colour(itr);
+        }
+    }
+}
+
+static void encode_band(pipeline_args* pargs, size_t band) {
+    pipeline_state* state = pargs->state;
+    const thread_args& params = *state->params;
+    size_t const img_width = params.img_width;
+    size_t const y0 = band * pipeline_band_rows;
+    size_t const rows = std::min(pipeline_band_rows, params.img_height - y0);
+    size_t const above = band > 0; //the row above is only read, for the filters that look up
+    size_t const filtered_size = rows * (1 + img_width * 3);
+    timing_point const start = thread_timing_now();
+    uint64_t const trace_start = trace_now();
+
+    //lodepng filters the bytes in the colour mode it writes, so the always opaque alpha goes first
+    auto* rgb = (unsigned char*) lodepng_malloc((rows + above) * img_width * 3);
+    auto* filtered = (unsigned char*) lodepng_malloc(filtered_size);
+    unsigned error = rgb && filtered ? 0 : 83;
+    if (!error) {
+        const auto* src = (const unsigned char*) (params.pixels + (y0 - above) * img_width);
+        for (size_t i = 0; i < (rows + above) * img_width; i++) {
+            rgb[i * 3 + 0] = src[i * 4 + 0];
+            rgb[i * 3 + 1] = src[i * 4 + 1];
+            rgb[i * 3 + 2] = src[i * 4 + 2];
+        }
+    }
+
+    LodePNGColorMode colour;
+    lodepng_color_mode_init(&colour);
+    colour.colortype = LCT_RGB;
+    colour.bitdepth = 8;
+    LodePNGEncoderSettings settings;
+    lodepng_encoder_settings_init(&settings);
+    if (!error)
+        error = lodepng_filter_rows(filtered, rgb + above * img_width * 3, above ? rgb : nullptr, img_width, rows,
+                                    &colour, &settings);
+    lodepng_free(rgb);
+    pargs->copied[stage_filter] += (rows + above) * img_width * 3;
+    timing_point const filtered_at = thread_timing_now();
+    add_spent(pargs->spent[stage_filter], start, filtered_at);
+    trace_span("filter band", trace_start, "band", band);
+    uint64_t const deflate_start = trace_now();
+
+    //the zlib header goes in front of the first band, the adler32 trailer is written once every band is
+    unsigned char* data = nullptr;
+    size_t data_size = 0;
+    if (!error && band == 0) {
+        data = (unsigned char*) lodepng_malloc(2);
+        if (!data)
+            error = 83;
+        else
+            data[0] = 0x78, data[1] = 0x01, data_size = 2;
+    }
+    if (!error)
+        error = lodepng_deflate_part(&data, &data_size, filtered, filtered_size, &settings.zlibsettings,
+                                     band == state->num_bands - 1);
+    encoded_band& encoded = state->encoded[band];
+    if (!error) {
+        encoded.adler = adler32(filtered, filtered_size);
+        encoded.filtered_size = filtered_size;
+        error = lodepng_chunk_create(&encoded.chunk, &encoded.chunk_size, (unsigned) data_size, "IDAT", data);
+        pargs->copied[stage_deflate] += data_size;
+    }
+    lodepng_free(data);
+    lodepng_free(filtered);
+    add_spent(pargs->spent[stage_deflate], filtered_at, thread_timing_now());
+    trace_span("deflate band", deflate_start, "band", band);
+
+    if (error) {
+        fprintf(stderr, "Failed to encode rows %zu to %zu: %s\n", y0, y0 + rows, lodepng_error_text(error));
+        state->failed = true;
+    }
+    state->encode_done[band] = true;
+}
+
+//writes every band that's next in line and encoded, unless another thread is already at it, in which case it will
+//see this band too, since it checks again after letting go
+static void write_ready(pipeline_args* pargs) {
+    pipeline_state* state = pargs->state;
+    do {
+        if (state->writing.exchange(true))
+            return;
+        timing_point const start = thread_timing_now();
+        size_t next;
+        while ((next = state->next_write) < state->num_bands && state->encode_done[next]) {
+            encoded_band& band = state->encoded[next];
+            uint64_t const write_start = trace_now();
+            if (!state->failed && fwrite(band.chunk, 1, band.chunk_size, state->file) != band.chunk_size) {
+                fprintf(stderr, "Failed writing rows from %zu\n", next * pipeline_band_rows);
+                state->failed = true;
+            }
+            trace_span("write band", write_start, "band", next);
+            state->bytes_written += band.chunk_size;
+            pargs->copied[stage_write] += band.chunk_size;
+            state->adler = next == 0 ? band.adler : adler32_combine(state->adler, band.adler, band.filtered_size);
+            lodepng_free(band.chunk);
+            band.chunk = nullptr;
+            state->next_write = next + 1;
+        }
+        add_spent(pargs->spent[stage_write], start, thread_timing_now());
+        state->writing = false;
+    } while (state->next_write < state->num_bands && state->encode_done[state->next_write]);
+}
+
+//encoding comes first whenever there's a band ready, so finished rows don't pile up behind the ones being computed
+static int pipeline_thread(void* args) {
+    auto* pargs = (pipeline_args*) args;
+    pipeline_state* state = pargs->state;
+    tile_t tile{};
+    size_t band;
+    while (true) {
+        if (pop_band(state, band)) {
+            encode_band(pargs, band);
+            write_ready(pargs);
+            continue;
+        }
+        if (!state->tiles->claim(pargs->thread_num, tile))
+            break;
+        timing_point const start = thread_timing_now();
+        uint64_t const tile_start = trace_now();
+        size_t const itrs_before = pargs->counts.itrs;
+        compute_tile(pargs, tile);
+        trace_span("compute tile", tile_start, "tile", tile.index);
+        add_tile_cost(state->params->tile_costs, tile.index, pargs->counts.itrs - itrs_before, start.wall);
+        add_spent(pargs->spent[stage_compute], start, thread_timing_now());
+
+        band = tile.y0 / pipeline_band_rows;
+        if (state->tiles_left[band].fetch_sub(1) == 1) {
+            band_dependency_done(state, band);
+            if (band + 1 < state->num_bands)
+                band_dependency_done(state, band + 1);
+        }
+    }
+    return 0;
+}
+
+int render_pipelined(const char* filename, const thread_args& params, thread_pool& pool, stage_times& times,
+                     pipeline_result& result) {
+    timing_point const pipeline_start = timing_now();
+    result = {{0, 0}, 0, 0, 0};
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open %s for writing\n", filename);
+        return 1;
+    }
+    static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    unsigned char ihdr[13] = {0, 0, 0, 0, 0, 0, 0, 0, 8, LCT_RGB, 0, 0, 0}; //8 bit, no interlacing
+    put_be32(ihdr, params.img_width);
+    put_be32(ihdr + 4, params.img_height);
+    unsigned char* header = nullptr;
+    size_t header_size = 0;
+    lodepng_chunk_create(&header, &header_size, sizeof(ihdr), "IHDR", ihdr);
+    bool ok = header && fwrite(signature, 1, sizeof(signature), file) == sizeof(signature)
+            && fwrite(header, 1, header_size, file) == header_size;
+    lodepng_free(header);
+
+    //tiles are handed out top down from a single band so rows finish, and can be encoded, roughly in order
+    tile_scheduler tiles(params.img_width, params.img_height, 1, pipeline_band_rows);
+    size_t const num_bands = tiles.rows();
+    size_t const num_threads = pool.size();
+    auto* state = new pipeline_state;
+    state->params = &params;
+    state->tiles = &tiles;
+    state->num_bands = num_bands;
+    state->tiles_left = new std::atomic<size_t>[num_bands];
+    state->waiting_on = new std::atomic<size_t>[num_bands];
+    state->encoded = new encoded_band[num_bands];
+    state->encode_done = new std::atomic<bool>[num_bands];
+    for (size_t b = 0; b < num_bands; b++) {
+        state->tiles_left[b] = tiles.columns();
+        state->waiting_on[b] = b > 0 ? 2 : 1;
+        state->encoded[b] = {nullptr, 0, 1, 0};
+        state->encode_done[b] = false;
+    }
+    mtx_init(&state->queue_lock, mtx_plain);
+    state->queue = new size_t[num_bands];
+    state->queue_head = 0;
+    state->queue_tail = 0;
+    state->writing = false;
+    state->next_write = 0;
+    state->file = file;
+    state->adler = 1;
+    state->bytes_written = header_size + sizeof(signature);
+    state->failed = !ok;
+
+    auto* args = new pipeline_args[num_threads];
+    for (size_t i = 0; i < num_threads; i++)
+        args[i] = {state, i, {0, 0}, 0, {}, {}};
+    pool.run(&pipeline_thread, args);
+
+    //the zlib trailer is its own small IDAT, then the end chunk
+    unsigned char adler[4];
+    put_be32(adler, state->adler);
+    unsigned char* trailer = nullptr;
+    size_t trailer_size = 0;
+    lodepng_chunk_create(&trailer, &trailer_size, sizeof(adler), "IDAT", adler);
+    lodepng_chunk_create(&trailer, &trailer_size, 0, "IEND", nullptr);
+    ok = !state->failed && state->next_write == num_bands && trailer
+            && fwrite(trailer, 1, trailer_size, file) == trailer_size;
+    lodepng_free(trailer);
+    if (fclose(file) != 0)
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Failed writing %s\n", filename);
+
+    for (size_t i = 0; i < num_threads; i++) {
+        result.counts.itrs += args[i].counts.itrs;
+        result.counts.shortcuts += args[i].counts.shortcuts;
+        result.interior_pixels += args[i].interior_pixels;
+        for (stage_id stage : {stage_compute, stage_filter, stage_deflate, stage_write}) {
+            timing_point const& spent = args[i].spent[stage];
+            stage_add(times, stage, spent.wall, spent.cpu, spent.minor_faults, spent.major_faults);
+            stage_copied(times, stage, args[i].copied[stage]);
+        }
+    }
+    result.bands = num_bands;
+    result.bytes_written = ok ? state->bytes_written + trailer_size : 0;
+
+    delete[] args;
+    for (size_t b = 0; b < num_bands; b++)
+        lodepng_free(state->encoded[b].chunk); //only left over if writing stopped early
+    mtx_destroy(&state->queue_lock);
+    delete[] state->queue;
+    delete[] state->encode_done;
+    delete[] state->encoded;
+    delete[] state->waiting_on;
+    delete[] state->tiles_left;
+    delete state;
+    stage_add(times, stage_pipeline, pipeline_start, timing_now());
+    return ok ? 0 : 1;
+}
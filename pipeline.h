@@ -0,0 +1,30 @@
+#ifndef FRACTALFUN_PIPELINE_H
+#define FRACTALFUN_PIPELINE_H
+
+#include <cstddef>
+
+#include "fractal.h"
+#include "render.h"
+#include "thread_pool.h"
+#include "timing.h"
+
+typedef struct pipeline_result {
+    sample_counts counts;
+    size_t interior_pixels;
+    size_t bands;
+    size_t bytes_written;
+} pipeline_result;
+
+/*
+ * Computes, colours, filters, deflates and writes the PNG in a single pool pass instead of one after the other.
+ * Threads compute tiles top down, and once a band of rows and the one above it are done the band is filtered and
+ * deflated on its own, by whichever thread is free, while later bands are still being computed. Bands are written
+ * out in order as soon as they and everything above them are encoded, as an IDAT chunk each.
+ * Uses the pixels, view, size and max_itrs from params, the other fields are ignored. The image is written as 8 bit
+ * RGB, since every colour is opaque anyway. Stage times are summed over threads since the stages overlap, with
+ * stage_pipeline holding the elapsed time. Returns 0 on success.
+ */
+int render_pipelined(const char* filename, const thread_args& params, thread_pool& pool, stage_times& times,
+                     pipeline_result& result);
+
+#endif //FRACTALFUN_PIPELINE_H
@@ -0,0 +1,157 @@
+#include "preview.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "fractal.h"
+#include "auto_itrs.h"
+#include "timing.h"
+#include "view_map.h"
+
+//GCC vector extensions rather than intrinsics so this builds anywhere, one 16 byte register each. Vectors wider than
+//the target has get split up badly enough to lose to the scalar kernel, 4 doubles on plain x86-64 are 3x slower
+const size_t preview_vector_bytes = 16;
+typedef float float_lanes __attribute__((vector_size(preview_vector_bytes)));
+typedef int32_t float_mask __attribute__((vector_size(preview_vector_bytes)));
+typedef double double_lanes __attribute__((vector_size(preview_vector_bytes)));
+typedef int64_t double_mask __attribute__((vector_size(preview_vector_bytes)));
+
+//float is only used while a pixel is at least this many float ulps of the view's coordinates wide
+const double float_pixel_ulps = 256;
+//escape checks are this many iterations apart, lanes that escape in between are frozen rather than overshooting
+const size_t lane_check_interval = 4;
+//rows handed to a thread at a time
+const size_t preview_row_batch = 4;
+//the three sines per pixel cost more than iterating does at preview caps, so colours come from a table with this many
+//entries per iteration, close enough that neighbouring entries are at most a shade apart
+const size_t palette_steps = 16;
+
+typedef struct preview_args {
+    const preview_request* request;
+    size_t max_itrs;
+    bool single;
+    std::atomic<size_t>* next_row;
+    const uint32_t* palette; //max_itrs * palette_steps + 1 colours
+    size_t itrs; //out
+} preview_args;
+
+//iterates a vector's worth of points at once, leaving the escape iteration (escape_time's) and final z for each lane,
+//or max_itrs for lanes that didn't escape. Returns the iterations run
+template<typename T, typename V, typename M>
+static size_t iterate_lanes(const double* c_real, double c_img, size_t max_itrs, size_t* escape_itr, double* z_real,
+                            double* z_img) {
+    constexpr size_t lanes = sizeof(V) / sizeof(T);
+    V cr, ci, zr{}, zi{};
+    M active;
+    for (size_t l = 0; l < lanes; l++) {
+        cr[l] = (T) c_real[l];
+        ci[l] = (T) c_img;
+        active[l] = in_main_bulbs(complex_t{c_real[l], c_img}) ? 0 : -1;
+    }
+    M count{};
+    for (size_t itr = 0; itr < max_itrs; itr++) {
+        V const zr2 = zr * zr, zi2 = zi * zi;
+        active &= (M) (zr2 + zi2 <= 4);
+        if (itr % lane_check_interval == 0) {
+            M const none{};
+            if (memcmp(&active, &none, sizeof(M)) == 0)
+                break;
+        }
+        V const next_zi = 2 * zr * zi + ci;
+        V const next_zr = zr2 - zi2 + cr;
+        zr = active ? next_zr : zr;
+        zi = active ? next_zi : zi;
+        count -= active;
+    }
+
+    size_t itrs = 0;
+    for (size_t l = 0; l < lanes; l++) {
+        itrs += count[l];
+        z_real[l] = zr[l];
+        z_img[l] = zi[l];
+        bool const escaped = z_real[l] * z_real[l] + z_img[l] * z_img[l] > 4;
+        escape_itr[l] = escaped ? count[l] - 1 : max_itrs;
+    }
+    return itrs;
+}
+
+//colours one row, returns the iterations run
+template<typename T, typename V, typename M>
+static size_t preview_row(const preview_args& pargs, size_t y) {
+    constexpr size_t lanes = sizeof(V) / sizeof(T);
+    const preview_request& request = *pargs.request;
+    size_t const img_width = request.img_width;
+    size_t const max_itrs = pargs.max_itrs;
+    view_map<double> const view(request.left_top, request.right_bottom, img_width, request.img_height);
+    double const c_img = view.imag_at(y);
+    uint32_t* row = request.pixels + y * img_width;
+    size_t itrs = 0;
+
+    double c_real[lanes], z_real[lanes], z_img[lanes];
+    size_t escape_itr[lanes];
+    for (size_t x0 = 0; x0 < img_width; x0 += lanes) {
+        for (size_t l = 0; l < lanes; l++) //lanes past the edge just repeat work on the last pixel
+            c_real[l] = view.real_at(std::min(x0 + l, img_width - 1));
+        itrs += iterate_lanes<T, V, M>(c_real, c_img, max_itrs, escape_itr, z_real, z_img);
+        for (size_t l = 0; l < lanes && x0 + l < img_width; l++) {
+            if (escape_itr[l] == max_itrs) {
+                row[x0 + l] = inside_colour.packed();
+                continue;
+            }
+            //continuous_index without going through a complex abs
+            double const index = escape_itr[l] + 1 - 1 / sqrt(z_real[l] * z_real[l] + z_img[l] * z_img[l]);
+            row[x0 + l] = pargs.palette[std::min((size_t) (index * palette_steps + 0.5), max_itrs * palette_steps)];
+        }
+    }
+    return itrs;
+}
+
+static int preview_rows(void* args) {
+    auto* pargs = (preview_args*) args;
+    size_t const img_height = pargs->request->img_height;
+    size_t itrs = 0;
+    for (size_t first = pargs->next_row->fetch_add(preview_row_batch); first < img_height;
+         first = pargs->next_row->fetch_add(preview_row_batch)) {
+        for (size_t y = first; y < std::min(first + preview_row_batch, img_height); y++) {
+            if (pargs->single)
+                itrs += preview_row<float, float_lanes, float_mask>(*pargs, y);
+            else
+                itrs += preview_row<double, double_lanes, double_mask>(*pargs, y);
+        }
+    }
+    pargs->itrs = itrs;
+    return 0;
+}
+
+int render_preview(const preview_request& request, thread_pool& pool, preview_stats& stats) {
+    if (!request.pixels || request.img_width == 0 || request.img_height == 0)
+        return 1;
+    double const start = wall_now();
+    double const delta = std::min(fabs(request.right_bottom.real() - request.left_top.real()) / request.img_width,
+                                  fabs(request.left_top.imag() - request.right_bottom.imag()) / request.img_height);
+    double const magnitude = std::max({fabs(request.left_top.real()), fabs(request.left_top.imag()),
+                                       fabs(request.right_bottom.real()), fabs(request.right_bottom.imag()), 1.0});
+    stats.single_precision = delta >= magnitude * FLT_EPSILON * float_pixel_ulps;
+    stats.itrs_cap = std::min(request.max_itrs, depth_itrs_guess(request.left_top, request.right_bottom));
+
+    std::vector<uint32_t> palette(stats.itrs_cap * palette_steps + 1);
+    for (size_t i = 0; i < palette.size(); i++)
+        palette[i] = escaped_colour((double) i / palette_steps);
+
+    std::atomic<size_t> next_row{0};
+    size_t const num_threads = pool.size();
+    auto* args = new preview_args[num_threads];
+    for (size_t i = 0; i < num_threads; i++)
+        args[i] = {&request, stats.itrs_cap, stats.single_precision, &next_row, palette.data(), 0};
+    pool.run(&preview_rows, args);
+    stats.itrs = 0;
+    for (size_t i = 0; i < num_threads; i++)
+        stats.itrs += args[i].itrs;
+    delete[] args;
+    stats.wall = wall_now() - start;
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef FRACTALFUN_PREVIEW_H
+#define FRACTALFUN_PREVIEW_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "complex_t.h"
+#include "thread_pool.h"
+
+const size_t default_preview_width = 1280;
+const size_t default_preview_height = 720;
+
+typedef struct preview_request {
+    complex_t left_top;
+    complex_t right_bottom;
+    size_t img_width;
+    size_t img_height;
+    size_t max_itrs; //upper bound, the depth of the zoom usually caps it lower
+    uint32_t* pixels; //caller's, img_width * img_height packed colours, so no image is allocated per frame
+} preview_request;
+
+typedef struct preview_stats {
+    size_t itrs_cap; //what max_itrs actually was
+    bool single_precision;
+    size_t itrs; //iterations run
+    double wall;
+} preview_stats;
+
+/*
+ * Renders a frame for interactive use rather than a final image: straight into the caller's buffer with no disk I/O,
+ * 4 pixels at a time in a vector of floats while the pixels are far enough apart for float to tell them apart (2 in
+ * doubles otherwise), and capped at depth_itrs_guess iterations for the zoom. Colours match a full render at that cap
+ * to within a shade, apart from the odd pixel float rounding tips over. Rows are shared out over the pool as threads
+ * free up. Returns 0 on success.
+ */
+int render_preview(const preview_request& request, thread_pool& pool, preview_stats& stats);
+
+#endif //FRACTALFUN_PREVIEW_H
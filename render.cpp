@@ -0,0 +1,275 @@
+#include "render.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "fractal.h"
+#include "view_map.h"
+#include "trace.h"
+
+int compute_fractal(void* args) {
+    size_t const thread_num = ((thread_args*) args)->thread_num;
+    size_t const max_itrs = ((thread_args*) args)->max_itrs;
+    size_t const img_width = ((thread_args*) args)->img_width;
+    size_t const img_height = ((thread_args*) args)->img_height;
+
+    complex_t const left_top = ((thread_args*) args)->left_top;
+    complex_t const right_bottom = ((thread_args*) args)->right_bottom;
+    view_map<complex_t::value_type> const view(left_top, right_bottom, img_width, img_height);
+
+//    complex_t* grid = ((thread_args*) args)->grid;
+    auto* pixels = ((thread_args*) args)->pixels;
+//    printf("id: %zu, delta_img: %f, delta_real: %f\n", thread_num, delta_img, delta_real);
+
+//    for (size_t y = thread_num; y < img_height; y += num_threads) {
+//        complex_t y_val = complex_t{0, left_top.imag() - y * delta_img};
+//
+//        for (size_t x = 0; x < img_width; x++) {
+//            complex_t x_val = complex_t{left_top.real() + x * delta_real, 0};
+//            grid[y * img_width + x] = x_val + y_val;
+//        }
+//    }
+
+    auto* iterations = ((thread_args*) args)->iterations;
+    auto* unescaped = ((thread_args*) args)->unescaped;
+
+    tile_cost* const tile_costs = ((thread_args*) args)->tile_costs;
+    size_t const step = ((thread_args*) args)->refine_step;
+    bool const first = ((thread_args*) args)->refine_first;
+    sample_counts counts{0, 0};
+
+    tile_t tile{};
+    size_t tiles_done = 0, tiles_stolen = 0;
+    while (((thread_args*) args)->tiles->claim(thread_num, tile)) {
+        tiles_done++;
+        tiles_stolen += tile.stolen;
+        uint64_t const tile_start = trace_now();
+        double const cost_start = tile_costs ? wall_now() : 0;
+        size_t const itrs_before = counts.itrs;
+        //tiles are aligned to the coarsest step, so the first row and column on this step's grid are the tile's own
+        for (size_t y = tile.y0; y < tile.y1; y += step) {
+            //rows that were on the previous, twice as coarse, grid already have every other pixel filled in
+            size_t x_start = 0, x_step = step;
+            if (!first && y % (2 * step) == 0) {
+                x_start = step;
+                x_step = 2 * step;
+            }
+            for (size_t x = tile.x0 + x_start; x < tile.x1; x += x_step) {
+                complex_t c = view.point(x, y); //grid[y * img_width + x];
+//                std::cout << c << "\n";
+                size_t const index = y * img_width + x;
+                if (unescaped) {
+                    //points the shortcut rejects can never escape, so there's nothing worth saving to continue them from
+                    if (in_main_bulbs(c)) {
+                        iterations[index] = interior_itr;
+                        counts.shortcuts++;
+                        continue;
+                    }
+                    complex_t z = complex_t{0, 0};
+                    iterations[index] = continue_index(c, z, 0, max_itrs, counts);
+                    if (iterations[index] == interior_itr)
+                        unescaped->push_back({index, z});
+                    continue;
+                }
+                store_index(pixels, iterations, index, sample_index(c, max_itrs, counts));
+            }
+        }
+        trace_span("compute tile", tile_start, "tile", tile.index);
+        add_tile_cost(tile_costs, tile.index, counts.itrs - itrs_before, cost_start);
+    }
+    ((thread_args*) args)->tiles_done = tiles_done;
+    ((thread_args*) args)->tiles_stolen = tiles_stolen;
+    ((thread_args*) args)->counts = counts;
+//    printf("id: %zu min: %f, max: %f\n", thread_num, min_esc_thr[thread_num], max_esc_thr[thread_num]);
+    return 0;
+}
+
+int colour_iterations(void* args) {
+    auto* targs = (thread_args*) args;
+    size_t const img_width = targs->img_width;
+    size_t interior = 0;
+    tile_t tile{};
+    size_t tiles_done = 0, tiles_stolen = 0;
+    while (targs->tiles->claim(targs->thread_num, tile)) {
+        tiles_done++;
+        tiles_stolen += tile.stolen;
+        uint64_t const tile_start = trace_now();
+        for (size_t y = tile.y0; y < tile.y1; y++) {
+            for (size_t x = tile.x0; x < tile.x1; x++) {
+                float const itr = load_index(targs->pixels, targs->iterations, y * img_width + x);
+                interior += itr == interior_itr;
+                targs->pixels[y * img_width + x] = iteration_colour(itr);
+            }
+        }
+        trace_span("colour tile", tile_start, "tile", tile.index);
+    }
+    targs->interior_pixels = interior;
+    targs->tiles_done = tiles_done;
+    targs->tiles_stolen = tiles_stolen;
+    return 0;
+}
+
+int colour_from_file(void* args) {
+    auto* targs = (thread_args*) args;
+    const itr_file_map& source = *targs->source;
+    size_t const img_width = targs->img_width;
+    bool const whole_itrs = source.header.plane_type == itr_plane_uint32;
+    auto* scratch = new uint32_t[(size_t) source.header.tile_size * source.header.tile_size];
+    size_t interior = 0;
+    tile_t tile{};
+    size_t tiles_done = 0, tiles_stolen = 0;
+    while (targs->tiles->claim(targs->thread_num, tile)) {
+        tiles_done++;
+        tiles_stolen += tile.stolen;
+        uint64_t const tile_start = trace_now();
+        const uint32_t* values = itr_file_tile(source, tile.index, scratch);
+        if (!values) { //the rest of the image is still worth having
+            fprintf(stderr, "Tile %zu of the iteration file is corrupt, leaving it blank\n", tile.index);
+            continue;
+        }
+        size_t const tile_width = tile.x1 - tile.x0;
+        for (size_t y = tile.y0; y < tile.y1; y++) {
+            const uint32_t* row = values + (y - tile.y0) * tile_width;
+            for (size_t x = 0; x < tile_width; x++) {
+                float itr;
+                if (whole_itrs)
+                    itr = row[x] == itr_plane_interior ? interior_itr : (float) row[x];
+                else
+                    itr = std::bit_cast<float>(row[x]);
+                interior += itr == interior_itr;
+                targs->pixels[y * img_width + tile.x0 + x] = iteration_colour(itr);
+            }
+        }
+        trace_span("colour file tile", tile_start, "tile", tile.index);
+    }
+    delete[] scratch;
+    targs->interior_pixels = interior;
+    targs->tiles_done = tiles_done;
+    targs->tiles_stolen = tiles_stolen;
+    return 0;
+}
+
+int first_touch(void* args) {
+    auto* targs = (thread_args*) args;
+    size_t const first_row = targs->tiles->band_first_row(targs->thread_num);
+    size_t const rows = targs->tiles->band_end_row(targs->thread_num) - first_row;
+    size_t const img_width = targs->img_width;
+    memset(targs->pixels + first_row * img_width, 0, rows * img_width * sizeof(uint32_t));
+    if (targs->iterations && !targs->resume) //a continued render's iterations already hold the saved ones
+        memset(targs->iterations + first_row * img_width, 0, rows * img_width * sizeof(float));
+    return 0;
+}
+
+int continue_fractal(void* args) {
+    auto* targs = (thread_args*) args;
+    size_t const max_itrs = targs->max_itrs;
+    size_t const img_width = targs->img_width;
+    size_t const img_height = targs->img_height;
+
+    complex_t const left_top = targs->left_top;
+    complex_t const right_bottom = targs->right_bottom;
+    view_map<complex_t::value_type> const view(left_top, right_bottom, img_width, img_height);
+
+    auto* iterations = targs->iterations;
+    auto* unescaped = targs->unescaped;
+    sample_counts counts{0, 0};
+
+    for (size_t i = targs->thread_num; i < targs->resume_count; i += targs->num_threads) {
+        size_t const index = targs->resume[i].index;
+        size_t const x = index % img_width;
+        size_t const y = index / img_width;
+        complex_t c = view.point(x, y);
+        complex_t z = targs->resume[i].z;
+        iterations[index] = continue_index(c, z, targs->resume_itrs, max_itrs, counts);
+        if (unescaped && iterations[index] == interior_itr)
+            unescaped->push_back({index, z});
+    }
+    targs->counts = counts;
+    return 0;
+}
+
+//cheap deterministic hash so the jitter pattern is the same between runs
+static inline double jitter(size_t x, size_t y, size_t n) {
+    uint64_t h = (x * 0x9E3779B97F4A7C15ULL) ^ (y * 0xC2B2AE3D27D4EB4FULL) ^ (n * 0x165667B19E3779F9ULL);
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return (h >> 11) * 0x1.0p-53;
+}
+
+bool needs_refinement(const float* iterations, size_t x, size_t y, size_t img_width, size_t img_height, double threshold) {
+    const float centre = iterations[y * img_width + x];
+    for (size_t ny = (y > 0 ? y - 1 : y); ny <= y + 1 && ny < img_height; ny++) {
+        for (size_t nx = (x > 0 ? x - 1 : x); nx <= x + 1 && nx < img_width; nx++) {
+            const float other = iterations[ny * img_width + nx];
+            if ((other == interior_itr) != (centre == interior_itr))
+                return true;
+            if (centre != interior_itr && fabs(other - centre) > threshold)
+                return true;
+        }
+    }
+    return false;
+}
+
+int antialias_fractal(void* args) {
+    auto* targs = (thread_args*) args;
+    size_t const thread_num = targs->thread_num;
+    size_t const max_itrs = targs->max_itrs;
+    size_t const img_width = targs->img_width;
+    size_t const img_height = targs->img_height;
+    size_t const samples = targs->aa_samples;
+    double const threshold = targs->aa_threshold;
+
+    complex_t const left_top = targs->left_top;
+    complex_t const right_bottom = targs->right_bottom;
+    view_map<complex_t::value_type> const view(left_top, right_bottom, img_width, img_height);
+
+    auto* pixels = targs->pixels;
+    const float* iterations = targs->iterations;
+    const histogram_palette* histogram = targs->histogram;
+    size_t refined = 0;
+    sample_counts counts{0, 0};
+
+    //only pixels are written here, the iteration buffer is left alone so every thread sees the same neighbours
+    tile_t tile{};
+    size_t tiles_done = 0, tiles_stolen = 0;
+    while (targs->tiles->claim(thread_num, tile)) {
+        tiles_done++;
+        tiles_stolen += tile.stolen;
+        uint64_t const tile_start = trace_now();
+        double const cost_start = targs->tile_costs ? wall_now() : 0;
+        size_t const itrs_before = counts.itrs;
+        for (size_t y = tile.y0; y < tile.y1; y++) {
+            for (size_t x = tile.x0; x < tile.x1; x++) {
+                if (!needs_refinement(iterations, x, y, img_width, img_height, threshold))
+                    continue;
+
+                //stratified: one jittered sample in each cell of a samples x samples grid covering the pixel
+                uint64_t red = 0, green = 0, blue = 0; //samples * samples * 255 outgrows 32 bits past -as 4096
+                for (size_t sy = 0; sy < samples; sy++) {
+                    for (size_t sx = 0; sx < samples; sx++) {
+                        size_t n = sy * samples + sx;
+                        double px = x + (sx + jitter(x, y, 2 * n)) / samples;
+                        double py = y + (sy + jitter(x, y, 2 * n + 1)) / samples;
+                        complex_t c = complex_t{view.real_at(px), view.imag_at(py)};
+                        Colour colour{histogram ? histogram_colour(*histogram, sample_index(c, max_itrs, counts))
+                                                : sample_colour(c, max_itrs, counts)};
+                        red += colour.red();
+                        green += colour.green();
+                        blue += colour.blue();
+                    }
+                }
+                size_t total = samples * samples;
+                pixels[y * img_width + x] = Colour{(uint8_t) (red / total), (uint8_t) (green / total), (uint8_t) (blue / total), 255}.packed();
+                refined++;
+            }
+        }
+        trace_span("antialias tile", tile_start, "tile", tile.index);
+        add_tile_cost(targs->tile_costs, tile.index, counts.itrs - itrs_before, cost_start);
+    }
+    targs->aa_refined = refined;
+    targs->tiles_done = tiles_done;
+    targs->tiles_stolen = tiles_stolen;
+    targs->counts = counts;
+    return 0;
+}
@@ -0,0 +1,77 @@
+#ifndef FRACTALFUN_RENDER_H
+#define FRACTALFUN_RENDER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <bit>
+#include <vector>
+
+#include "complex_t.h"
+#include "itr_file.h"
+#include "fractal.h"
+#include "tile_scheduler.h"
+#include "tile_costs.h"
+#include "histogram.h"
+
+typedef struct thread_args {
+    size_t num_threads;
+    size_t thread_num; //[0, num_threads - 1]
+    size_t max_itrs;
+    size_t img_width;
+    size_t img_height;
+    complex_t left_top;
+    complex_t right_bottom;
+//    complex_t* grid;
+    uint32_t* pixels;
+    float* iterations; //continuous index per pixel, only allocated when a later pass needs it
+    tile_scheduler* tiles; //shared by every thread in the pass, reset between passes
+    double aa_threshold;
+    size_t aa_samples; //per axis
+    size_t aa_refined; //out
+    size_t refine_step; //only pixels on this grid are computed, 1 for every pixel
+    bool refine_first; //the coarsest level has nothing to skip
+    std::vector<continuation_point>* unescaped; //out, only kept when the iteration state is going to be saved
+    const continuation_point* resume; //pixels to carry on from resume_itrs iterations
+    size_t resume_count;
+    size_t resume_itrs;
+    sample_counts counts; //out
+    size_t interior_pixels; //out, from colour_iterations
+    size_t tiles_done; //out
+    size_t tiles_stolen; //out
+    const itr_file_map* source; //saved tiles for colour_from_file, whose tile size tiles has to match
+    tile_cost* tile_costs; //per tile index, what the compute and antialias passes spent on each, when not null
+    histogram_palette* histogram; //shared by the histogram passes, and antialias_fractal colours through it when not null
+} thread_args;
+
+//without a separate iteration buffer compute_fractal parks each index in its pixel until colour_iterations replaces it
+inline void store_index(uint32_t* pixels, float* iterations, size_t index, float itr) {
+    if (iterations)
+        iterations[index] = itr;
+    else
+        pixels[index] = std::bit_cast<uint32_t>(itr);
+}
+
+inline float load_index(const uint32_t* pixels, const float* iterations, size_t index) {
+    return iterations ? iterations[index] : std::bit_cast<float>(pixels[index]);
+}
+
+//a pixel is refined if any of its 8 neighbours differs by more than the threshold, or they don't agree on being inside
+bool needs_refinement(const float* iterations, size_t x, size_t y, size_t img_width, size_t img_height, double threshold);
+
+//Each of these is one thread's share of a pass, run with thread_pool::run over an array of thread_args
+
+//zeroes the rows of this thread's band in pixels (and iterations) so their pages are placed on its NUMA node
+int first_touch(void* args);
+//samples every pixel on the refine_step grid (every pixel at step 1) from z = 0, storing indices with store_index
+int compute_fractal(void* args);
+//carries the resume points on from resume_itrs to max_itrs in the iteration buffer. Colouring the result matches a
+//fresh render at max_itrs bit for bit only because both are coloured from the stored float, see iteration_colour
+int continue_fractal(void* args);
+//turns the stored indices into colours once every pixel has one
+int colour_iterations(void* args);
+//colours straight from a mapped iteration file's tiles instead of anything computed
+int colour_from_file(void* args);
+//supersamples pixels whose neighbourhood in the iteration buffer is too varied, needs the whole buffer done first
+int antialias_fractal(void* args);
+
+#endif //FRACTALFUN_RENDER_H
@@ -0,0 +1,280 @@
+#include "renderer.h"
+
+#include <cstdio>
+
+#include "big_alloc.h"
+#include "image_output.h"
+
+renderer::renderer(size_t num_threads, bool pin)
+        : workers(num_threads ? num_threads : default_thread_count(), pin), current{}, tiles(nullptr),
+          pixel_buffer(nullptr), pixel_bytes(0), iteration_buffer(nullptr), iteration_bytes(0), iterations_adopted(false),
+          resume_header{}, resume_points(nullptr), source{}, stage_time{}, running_totals{} {
+    args = new thread_args[workers.size()];
+    unescaped = new std::vector<continuation_point>[workers.size()];
+}
+
+renderer::~renderer() {
+    delete tiles;
+    delete[] args;
+    delete[] unescaped;
+    delete[] resume_points;
+    big_free(pixel_buffer, pixel_bytes);
+    free_iterations();
+    unmap_itr_file(source);
+}
+
+void renderer::free_iterations() {
+    if (iterations_adopted)
+        delete[] iteration_buffer;
+    else
+        big_free(iteration_buffer, iteration_bytes);
+    iteration_buffer = nullptr;
+    iteration_bytes = 0;
+    iterations_adopted = false;
+}
+
+//buffers are only replaced when they're too small, and only fresh ones are first touched since a reused one's pages
+//are already placed
+int renderer::allocate(size_t tile_size) {
+    timing_point const start = timing_now();
+    size_t const num_threads = workers.size();
+    size_t const num_pixels = current.img_width * current.img_height;
+    bool fresh = false;
+    if (num_pixels * sizeof(uint32_t) > pixel_bytes) {
+        big_free(pixel_buffer, pixel_bytes);
+        //mapped rather than new'd so no page is placed until first_touch below
+        pixel_buffer = (uint32_t*) big_alloc(num_pixels * sizeof(uint32_t));
+        pixel_bytes = pixel_buffer ? num_pixels * sizeof(uint32_t) : 0;
+        fresh = true;
+    }
+    if (current.keep_iterations && num_pixels * sizeof(float) > iteration_bytes) {
+        free_iterations();
+        iteration_buffer = (float*) big_alloc(num_pixels * sizeof(float));
+        iteration_bytes = iteration_buffer ? num_pixels * sizeof(float) : 0;
+        fresh = true;
+    }
+    if (!pixel_buffer || (current.keep_iterations && !iteration_buffer)) {
+        fprintf(stderr, "Could not allocate a %zupx x %zupx image\n", current.img_width, current.img_height);
+        return 1;
+    }
+    for (size_t i = 0; i < num_threads; i++)
+        unescaped[i].clear();
+
+    delete tiles;
+    tiles = new tile_scheduler(current.img_width, current.img_height, num_threads, tile_size);
+    costs.assign(current.keep_tile_costs ? tiles->columns() * tiles->rows() : 0, tile_cost{0, 0});
+    for (size_t i = 0; i < num_threads; i++) {
+        args[i] = {num_threads, i, current.max_itrs, current.img_width, current.img_height, current.left_top,
+                   current.right_bottom, pixel_buffer, current.keep_iterations ? iteration_buffer : nullptr, tiles,
+                   current.aa_threshold, current.aa_samples, 0, 1, true, current.keep_unescaped ? unescaped + i : nullptr,
+                   resume_points, resume_header.num_unescaped, resume_header.max_itrs};
+        args[i].source = source.data ? &source : nullptr;
+        args[i].tile_costs = current.keep_tile_costs ? costs.data() : nullptr;
+        args[i].histogram = current.histogram_colour ? &histogram : nullptr;
+    }
+    if (fresh)
+        workers.run(&first_touch, args);
+    stage_add(stage_time, stage_allocate, start, timing_now());
+    return 0;
+}
+
+//forgets everything about the last render other than its buffers
+static void clear_previous(stage_times& times, render_totals& totals) {
+    times = {};
+    totals = {};
+}
+
+int renderer::prepare(const render_spec& spec) {
+    if (spec.img_width == 0 || spec.img_height == 0 || spec.max_itrs == 0)
+        return 1;
+    clear_previous(stage_time, running_totals);
+    delete[] resume_points;
+    resume_points = nullptr;
+    resume_header = {};
+    unmap_itr_file(source);
+    source = {};
+
+    current = spec;
+    //anti-aliasing compares neighbouring indices and saving writes them out, so both need them kept apart from pixels
+    current.keep_iterations |= current.aa_threshold > 0 || current.keep_unescaped;
+    return allocate(default_tile_size);
+}
+
+int renderer::prepare_continue(const char* path, render_spec& spec) {
+    clear_previous(stage_time, running_totals);
+    unmap_itr_file(source);
+    source = {};
+    delete[] resume_points;
+    resume_points = nullptr;
+    float* loaded = nullptr;
+    if (read_itr_file(path, resume_header, loaded, resume_points))
+        return 1;
+    if (spec.max_itrs <= resume_header.max_itrs) {
+        fprintf(stderr, "Continuing needs more than the %zu iterations %s already has\n",
+                (size_t) resume_header.max_itrs, path);
+        delete[] loaded;
+        return 1;
+    }
+
+    //the saved indices are the iteration buffer from here on, whatever was there before goes
+    free_iterations();
+    iteration_buffer = loaded;
+    iteration_bytes = resume_header.width * resume_header.height * sizeof(float);
+    iterations_adopted = true;
+
+    spec.img_width = resume_header.width;
+    spec.img_height = resume_header.height;
+    spec.left_top = resume_header.left_top;
+    spec.right_bottom = resume_header.right_bottom;
+    spec.keep_iterations = true;
+    current = spec;
+    return allocate(default_tile_size);
+}
+
+int renderer::prepare_from(const char* path, render_spec& spec) {
+    clear_previous(stage_time, running_totals);
+    delete[] resume_points;
+    resume_points = nullptr;
+    resume_header = {};
+    unmap_itr_file(source);
+    source = {};
+    if (map_itr_file(path, source))
+        return 1;
+
+    //everything the pixels need is in the file, so nothing is computed and the iteration count is the saved one
+    spec.img_width = source.header.width;
+    spec.img_height = source.header.height;
+    spec.left_top = source.header.left_top;
+    spec.right_bottom = source.header.right_bottom;
+    spec.max_itrs = source.header.max_itrs;
+    spec.aa_threshold = 0;
+    spec.keep_iterations = false;
+    spec.keep_unescaped = false;
+    current = spec;
+    //colour_from_file decodes a saved tile per claimed tile, so the grids have to line up
+    return allocate(source.header.tile_size);
+}
+
+void renderer::add_counts() {
+    for (size_t i = 0; i < workers.size(); i++) {
+        running_totals.itrs += args[i].counts.itrs;
+        running_totals.shortcuts += args[i].counts.shortcuts;
+    }
+}
+
+//every tiled pass starts from a full set of tiles and counts how many went to a thread outside their band
+void renderer::run_tiled(int (*func)(void*)) {
+    tiles->reset();
+    for (size_t i = 0; i < workers.size(); i++)
+        args[i].tiles_stolen = 0;
+    workers.run(func, args);
+    for (size_t i = 0; i < workers.size(); i++)
+        running_totals.tiles_stolen += args[i].tiles_stolen;
+}
+
+void renderer::compute() {
+    timing_point const start = timing_now();
+    workers.reset_stats();
+    run_tiled(&compute_fractal);
+    add_counts();
+    stage_add(stage_time, stage_compute, start, timing_now());
+}
+
+void renderer::compute_progressive(size_t coarsest_step, const std::function<void(size_t step)>& level_done) {
+    timing_point const start = timing_now();
+    workers.reset_stats();
+    //each level only fills in the pixels the coarser ones didn't, so the total work is the same as a single pass
+    for (size_t step = coarsest_step; step >= 1; step /= 2) {
+        for (size_t i = 0; i < workers.size(); i++) {
+            args[i].refine_step = step;
+            args[i].refine_first = step == coarsest_step;
+        }
+        run_tiled(&compute_fractal);
+        add_counts();
+        if (level_done)
+            level_done(step);
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        args[i].refine_step = 1;
+        args[i].refine_first = true;
+    }
+    stage_add(stage_time, stage_compute, start, timing_now());
+}
+
+void renderer::compute_continue() {
+    timing_point const start = timing_now();
+    workers.reset_stats();
+    //everything that escaped last time keeps its index, only the rest get more iterations
+    workers.run(&continue_fractal, args);
+    add_counts();
+    stage_add(stage_time, stage_compute, start, timing_now());
+}
+
+int renderer::compute_pipelined(const char* filename, pipeline_result& result) {
+    workers.reset_stats();
+    if (render_pipelined(filename, args[0], workers, stage_time, result) != 0)
+        return 1;
+    running_totals.itrs += result.counts.itrs;
+    running_totals.shortcuts += result.counts.shortcuts;
+    running_totals.interior_pixels += result.interior_pixels;
+    return 0;
+}
+
+void renderer::colour() {
+    timing_point const start = timing_now();
+    workers.reset_stats();
+    if (current.histogram_colour && !source.data) {
+        //four passes, the middle two over the bins rather than the image
+        histogram_prepare(histogram, current.max_itrs, workers.size());
+        run_tiled(&count_histogram);
+        workers.run(&merge_histogram, args);
+        workers.run(&scan_histogram, args);
+        run_tiled(&map_histogram);
+    } else {
+        run_tiled(source.data ? &colour_from_file : &colour_iterations);
+    }
+    stage_add(stage_time, stage_colour, start, timing_now());
+    for (size_t i = 0; i < workers.size(); i++)
+        running_totals.interior_pixels += args[i].interior_pixels;
+}
+
+void renderer::antialias() {
+    if (current.aa_threshold <= 0)
+        return;
+    //the whole iteration buffer has to exist before we can compare neighbours
+    timing_point const start = timing_now();
+    workers.reset_stats();
+    run_tiled(&antialias_fractal);
+    stage_add(stage_time, stage_antialias, start, timing_now());
+    //shortcuts count pixels, and these are supersamples of pixels already counted, so only their iterations add up
+    for (size_t i = 0; i < workers.size(); i++) {
+        running_totals.aa_refined += args[i].aa_refined;
+        running_totals.itrs += args[i].counts.itrs;
+    }
+}
+
+size_t renderer::unescaped_count() const {
+    size_t count = 0;
+    for (size_t i = 0; i < workers.size(); i++)
+        count += unescaped[i].size();
+    return count;
+}
+
+int renderer::save(const char* path, itr_plane_type plane_type, itr_compression compression) {
+    if (!current.keep_unescaped) {
+        fprintf(stderr, "Nothing to save to %s, the render didn't keep its unescaped pixels\n", path);
+        return 1;
+    }
+    itr_file_header header{current.img_width, current.img_height, current.left_top, current.right_bottom,
+                           current.max_itrs, unescaped_count(), plane_type, compression, default_tile_size};
+    return write_itr_file(path, header, iteration_buffer, unescaped, workers.size(), workers);
+}
+
+unsigned renderer::encode_png(const char* filename, size_t& bytes_written, output_method& method) {
+    return write_png(filename, pixel_buffer, current.img_width, current.img_height, stage_time, bytes_written, method);
+}
+
+int renderer::encode_bmp(const char* filename, bmp_channel_order order, size_t& bytes_written, output_method& method) {
+    return write_bmp(filename, pixel_buffer, current.img_width, current.img_height, order, stage_time, bytes_written,
+                     method);
+}
@@ -0,0 +1,127 @@
+#ifndef FRACTALFUN_RENDERER_H
+#define FRACTALFUN_RENDERER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "complex_t.h"
+#include "bmpWriter.h"
+#include "itr_file.h"
+#include "output_file.h"
+#include "pipeline.h"
+#include "render.h"
+#include "thread_pool.h"
+#include "tile_scheduler.h"
+#include "timing.h"
+
+//What to render, the typed counterpart of the command line
+typedef struct render_spec {
+    complex_t left_top{-2, 1.5};
+    complex_t right_bottom{1, -1.5};
+    size_t img_width = 1024;
+    size_t img_height = 1024;
+    size_t max_itrs = 1500;
+    double aa_threshold = 0; //0 means no anti-aliasing
+    size_t aa_samples = 4; //per axis
+    bool keep_iterations = false; //a float plane next to the pixels, implied by anti-aliasing
+    bool keep_unescaped = false; //enough of every interior pixel to continue it later with save
+    bool keep_tile_costs = false; //iterations and time per tile over the tiled compute and antialias passes
+    bool histogram_colour = false; //equalise the palette over the image's indices, rather than colour by them directly
+} render_spec;
+
+//Running totals since the last prepare
+typedef struct render_totals {
+    size_t itrs;
+    size_t shortcuts; //pixels known to be interior without iterating, anti-aliasing's samples aren't counted
+    size_t interior_pixels;
+    size_t aa_refined;
+    size_t tiles_stolen;
+} render_totals;
+
+/*
+ * Owns a thread pool and the image sized buffers, and runs the render passes over them one call at a time, so a
+ * render can be embedded, benchmarked or driven a pass at a time instead of through the command line. A renderer is
+ * reused by calling one of the prepare functions again, which keeps the buffers if they are already big enough.
+ * Passes record their times in times() and reset the pool's stats first, so pool().print_stats after a pass covers
+ * just that pass. The usual order is prepare, compute, colour, antialias, then save and encode as wanted.
+ */
+class renderer {
+private:
+    thread_pool workers;
+    render_spec current;
+    tile_scheduler* tiles;
+    thread_args* args;
+    uint32_t* pixel_buffer;
+    size_t pixel_bytes;
+    float* iteration_buffer;
+    size_t iteration_bytes;
+    bool iterations_adopted; //new[]'d by read_itr_file rather than big_alloc'd
+    std::vector<continuation_point>* unescaped; //one list per thread when keep_unescaped
+    itr_file_header resume_header;
+    continuation_point* resume_points;
+    itr_file_map source;
+    std::vector<tile_cost> costs;
+    histogram_palette histogram;
+    stage_times stage_time;
+    render_totals running_totals;
+
+    int allocate(size_t tile_size);
+    void free_iterations();
+    void run_tiled(int (*func)(void*));
+    void add_counts();
+
+public:
+    //0 threads picks from the affinity mask and cgroup quota, pin binds each thread to its own cpu
+    explicit renderer(size_t num_threads = 0, bool pin = false);
+    ~renderer();
+    renderer(const renderer&) = delete;
+    renderer& operator=(const renderer&) = delete;
+
+    [[nodiscard]] thread_pool& pool() {return workers;};
+
+    //sizes the buffers for spec and places their pages, returns 0 on success
+    int prepare(const render_spec& spec);
+    //loads an iteration file to carry on to spec.max_itrs, which has to be more than it has already. spec's view and
+    //size are replaced by the file's, returns 0 on success
+    int prepare_continue(const char* path, render_spec& spec);
+    //maps an iteration file for colour to colour from without computing anything, spec is replaced by the file's
+    //view, size and max_itrs. Returns 0 on success
+    int prepare_from(const char* path, render_spec& spec);
+
+    //every pixel from scratch
+    void compute();
+    //coarse to fine from coarsest_step, a power of 2, with level_done called after each level
+    void compute_progressive(size_t coarsest_step, const std::function<void(size_t step)>& level_done);
+    //only the unescaped pixels from prepare_continue
+    void compute_continue();
+    //computes, colours and writes a png to filename all at once, see render_pipelined
+    int compute_pipelined(const char* filename, pipeline_result& result);
+    //turns the computed indices, or the file from prepare_from, into colours
+    void colour();
+    //supersamples pixels whose neighbourhood is too varied, after colour, only if spec.aa_threshold is set
+    void antialias();
+
+    //returns 0 on success, needs keep_iterations and keep_unescaped
+    int save(const char* path, itr_plane_type plane_type, itr_compression compression);
+    //lodepng's error code, 0 on success
+    unsigned encode_png(const char* filename, size_t& bytes_written, output_method& method);
+    //returns 0 on success
+    int encode_bmp(const char* filename, bmp_channel_order order, size_t& bytes_written, output_method& method);
+
+    [[nodiscard]] const render_spec& spec() const {return current;};
+    [[nodiscard]] const uint32_t* pixels() const {return pixel_buffer;};
+    [[nodiscard]] const float* iterations() const {return current.keep_iterations ? iteration_buffer : nullptr;};
+    [[nodiscard]] const itr_file_map* from_file() const {return source.data ? &source : nullptr;};
+    [[nodiscard]] const itr_file_header& continued_header() const {return resume_header;};
+    //interior pixels kept for save so far
+    [[nodiscard]] size_t unescaped_count() const;
+    [[nodiscard]] const render_totals& totals() const {return running_totals;};
+    [[nodiscard]] stage_times& times() {return stage_time;};
+    [[nodiscard]] const tile_scheduler& tile_grid() const {return *tiles;};
+    //per tile index of tile_grid, null unless spec.keep_tile_costs
+    [[nodiscard]] const tile_cost* tile_costs() const {return current.keep_tile_costs ? costs.data() : nullptr;};
+};
+
+#endif //FRACTALFUN_RENDERER_H
@@ -0,0 +1,245 @@
+#include "sequence.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "lodepng/lodepng.h"
+
+#include "big_alloc.h"
+#include "complex_t.h"
+#include "fractal.h"
+#include "render.h"
+#include "tile_scheduler.h"
+#include "view_map.h"
+
+//how far, in previous frame pixels, a sample point may be from an old one and still reuse its value
+const double reuse_tolerance = 1e-6;
+
+typedef struct view_t {
+    complex_t left_top;
+    complex_t right_bottom;
+} view_t;
+
+typedef struct frame_args {
+    size_t thread_num;
+    tile_scheduler* tiles; //shared by every thread, reset between frames
+    size_t max_itrs;
+    size_t img_width;
+    size_t img_height;
+    view_t view;
+    uint32_t* pixels;
+    float* iterations;
+    const float* prev_iterations; //null for the first frame
+    view_t prev_view;
+    size_t reused; //out
+    sample_counts counts; //out
+} frame_args;
+
+static int compute_frame(void* args) {
+    auto* fargs = (frame_args*) args;
+    size_t const max_itrs = fargs->max_itrs;
+    size_t const img_width = fargs->img_width;
+    size_t const img_height = fargs->img_height;
+    view_map<complex_t::value_type> const view(fargs->view.left_top, fargs->view.right_bottom, img_width, img_height);
+    view_map<complex_t::value_type> const prev_view(fargs->prev_view.left_top, fargs->prev_view.right_bottom, img_width,
+                                                    img_height);
+
+    auto* pixels = fargs->pixels;
+    auto* iterations = fargs->iterations;
+    const float* prev_iterations = fargs->prev_iterations;
+    size_t reused = 0;
+    sample_counts counts{0, 0};
+
+    tile_t tile{};
+    while (fargs->tiles->claim(fargs->thread_num, tile)) {
+        for (size_t y = tile.y0; y < tile.y1; y++) {
+            complex_t::value_type const c_img = view.imag_at(y);
+
+            //the row only lines up with an old one if its imaginary part does, which saves checking each pixel otherwise
+            bool row_reusable = false;
+            size_t prev_y = 0;
+            if (prev_iterations) {
+                double const py = prev_view.y_at(c_img);
+                double const rounded = std::round(py);
+                row_reusable = fabs(py - rounded) < reuse_tolerance && rounded >= 0 && rounded < img_height;
+                prev_y = (size_t) rounded;
+            }
+
+            for (size_t x = tile.x0; x < tile.x1; x++) {
+                complex_t c = complex_t{view.real_at(x), c_img};
+                size_t const index = y * img_width + x;
+                if (row_reusable) {
+                    double const px = prev_view.x_at(c.real());
+                    double const rounded = std::round(px);
+                    if (fabs(px - rounded) < reuse_tolerance && rounded >= 0 && rounded < img_width) {
+                        iterations[index] = prev_iterations[prev_y * img_width + (size_t) rounded];
+                        pixels[index] = iteration_colour(iterations[index]);
+                        reused++;
+                        continue;
+                    }
+                }
+                iterations[index] = sample_index(c, max_itrs, counts);
+                pixels[index] = iteration_colour(iterations[index]);
+            }
+        }
+    }
+    fargs->reused = reused;
+    fargs->counts = counts;
+    return 0;
+}
+
+static int read_keyframes(const char* keyframe_path, std::vector<view_t>& keyframes) {
+    FILE* file = fopen(keyframe_path, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open keyframe file %s\n", keyframe_path);
+        return 1;
+    }
+    char line[1024];
+    size_t line_num = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_num++;
+        char* p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '\n' || *p == '\0' || *p == '#')
+            continue;
+        double coords[4];
+        for (double& coord : coords) {
+            char* end;
+            coord = strtod(p, &end);
+            if (end == p) {
+                fprintf(stderr, "Keyframe file %s line %zu needs 4 co-ords\n", keyframe_path, line_num);
+                fclose(file);
+                return 1;
+            }
+            p = end;
+        }
+        keyframes.push_back({{coords[0], coords[1]}, {coords[2], coords[3]}});
+    }
+    fclose(file);
+    if (keyframes.size() < 2) {
+        fprintf(stderr, "Keyframe file %s needs at least 2 keyframes\n", keyframe_path);
+        return 1;
+    }
+    return 0;
+}
+
+//size is interpolated geometrically so the zoom speed stays constant, and the centre moves in step with the size
+//so a point that's on screen at both ends stays put relative to the frame
+static complex_t::value_type interpolate_axis(complex_t::value_type centre0, complex_t::value_type centre1,
+                                              complex_t::value_type size0, complex_t::value_type size1, double u,
+                                              complex_t::value_type& size) {
+    size = size0 * pow(size1 / size0, u);
+    if (fabs(size1 - size0) <= 1e-12 * fabs(size0))
+        return centre0 + (centre1 - centre0) * u;
+    return centre0 + (centre1 - centre0) * (size0 - size) / (size0 - size1);
+}
+
+static view_t interpolate_view(const view_t& from, const view_t& to, double u) {
+    complex_t::value_type width, height;
+    complex_t::value_type const centre_real = interpolate_axis(
+            (from.left_top.real() + from.right_bottom.real()) / 2, (to.left_top.real() + to.right_bottom.real()) / 2,
+            from.right_bottom.real() - from.left_top.real(), to.right_bottom.real() - to.left_top.real(), u, width);
+    complex_t::value_type const centre_img = interpolate_axis(
+            (from.left_top.imag() + from.right_bottom.imag()) / 2, (to.left_top.imag() + to.right_bottom.imag()) / 2,
+            from.left_top.imag() - from.right_bottom.imag(), to.left_top.imag() - to.right_bottom.imag(), u, height);
+    return {{centre_real - width / 2, centre_img + height / 2}, {centre_real + width / 2, centre_img - height / 2}};
+}
+
+int render_sequence(const char* keyframe_path, size_t num_frames, size_t max_itrs, size_t img_width, size_t img_height,
+                    thread_pool& pool) {
+    std::vector<view_t> keyframes;
+    if (read_keyframes(keyframe_path, keyframes))
+        return 1;
+    if (num_frames == 0)
+        num_frames = 1;
+
+    char* directory;
+    asprintf(&directory, "%s/sequence", type_name);
+    mkdir(type_name, S_IRWXU | S_IRWXG | S_IRWXO);
+    if (mkdir(directory, S_IRWXU | S_IRWXG | S_IRWXO) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Could not create %s\n", directory);
+        free(directory);
+        return 1;
+    }
+
+    //allocated once for the whole sequence, the previous frame's iterations are what the next one reuses from. Mapped
+    //and first touched by band like the renderer's buffers, so each thread's tiles are local to it
+    size_t const num_pixels = img_width * img_height;
+    auto* pixels = (uint32_t*) big_alloc(num_pixels * sizeof(uint32_t));
+    auto* iterations = (float*) big_alloc(num_pixels * sizeof(float));
+    auto* prev_iterations = (float*) big_alloc(num_pixels * sizeof(float));
+    if (!pixels || !iterations || !prev_iterations) {
+        fprintf(stderr, "Could not allocate %zupx x %zupx frames\n", img_width, img_height);
+        big_free(prev_iterations, num_pixels * sizeof(float));
+        big_free(iterations, num_pixels * sizeof(float));
+        big_free(pixels, num_pixels * sizeof(uint32_t));
+        free(directory);
+        return 1;
+    }
+    size_t const num_threads = pool.size();
+    tile_scheduler tiles(img_width, img_height, num_threads);
+    std::vector<thread_args> touch;
+    for (size_t i = 0; i < num_threads; i++)
+        touch.push_back({num_threads, i, max_itrs, img_width, img_height, {}, {}, pixels, iterations, &tiles, 0, 1, 0,
+                         1, true, nullptr, nullptr, 0, 0});
+    pool.run(&first_touch, touch.data());
+    for (thread_args& t : touch)
+        t.iterations = prev_iterations;
+    pool.run(&first_touch, touch.data());
+    auto* args = new frame_args[num_threads];
+
+    view_t prev_view{};
+    size_t total_reused = 0;
+    for (size_t frame = 0; frame < num_frames; frame++) {
+        struct timespec start{}, stop{};
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        double const t = num_frames == 1 ? 0 : (double) frame * (keyframes.size() - 1) / (num_frames - 1);
+        size_t const segment = std::min((size_t) t, keyframes.size() - 2);
+        view_t const view = interpolate_view(keyframes[segment], keyframes[segment + 1], t - segment);
+
+        tiles.reset();
+        for (size_t i = 0; i < num_threads; i++)
+            args[i] = {i, &tiles, max_itrs, img_width, img_height, view, pixels, iterations,
+                       frame == 0 ? nullptr : prev_iterations, prev_view, 0, {0, 0}};
+        pool.run(&compute_frame, args);
+        size_t reused = 0;
+        sample_counts counts{0, 0};
+        for (size_t i = 0; i < num_threads; i++) {
+            reused += args[i].reused;
+            counts.itrs += args[i].counts.itrs;
+            counts.shortcuts += args[i].counts.shortcuts;
+        }
+        total_reused += reused;
+
+        char* filename;
+        asprintf(&filename, "%s/frame_%05zu.png", directory, frame);
+        lodepng_encode32_file(filename, (unsigned char*) pixels, img_width, img_height);
+        free(filename);
+
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        printf("Frame %zu/%zu (%.10g, %+.10g)-(%.10g, %+.10g): reused %zu of %zu pixels, %zu iterations, %zu shortcut, %f\n", frame + 1,
+               num_frames, view.left_top.real(), view.left_top.imag(), view.right_bottom.real(), view.right_bottom.imag(),
+               reused, img_width * img_height, counts.itrs, counts.shortcuts, (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9);
+
+        std::swap(iterations, prev_iterations);
+        prev_view = view;
+    }
+    printf("Sequence of %zu frames written to %s, reused %zu pixels in total\n", num_frames, directory, total_reused);
+
+    delete[] args;
+    big_free(prev_iterations, num_pixels * sizeof(float));
+    big_free(iterations, num_pixels * sizeof(float));
+    big_free(pixels, num_pixels * sizeof(uint32_t));
+    free(directory);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef FRACTALFUN_SEQUENCE_H
+#define FRACTALFUN_SEQUENCE_H
+
+#include <cstddef>
+
+#include "thread_pool.h"
+
+/*
+ * Renders num_frames frames zooming through the keyframes in keyframe_path (one "C1x C1y C2x C2y" view per line,
+ * blank lines and lines starting with # are skipped) into type_name/sequence/. The pool and every buffer are kept
+ * across frames, and pixels whose sample point lines up with one from the previous frame are copied rather than
+ * iterated again. Returns 0 on success.
+ */
+int render_sequence(const char* keyframe_path, size_t num_frames, size_t max_itrs, size_t img_width, size_t img_height,
+                    thread_pool& pool);
+
+#endif //FRACTALFUN_SEQUENCE_H
@@ -0,0 +1,527 @@
+#include "serve.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include "lodepng/lodepng.h"
+
+#include "complex_t.h"
+#include "fractal.h"
+#include "big_alloc.h"
+#include "image_output.h"
+#include "tile_scheduler.h"
+#include "timing.h"
+#include "view_map.h"
+
+//sample grid offsets are rounded to this fraction of a pixel, so views panned by whole pixels land on the same grid
+const double grid_phase_steps = 1024;
+const size_t max_job_pixels = (size_t) 1 << 30;
+const size_t max_command_length = 4096;
+//missing tiles a job computes before putting them in the cache, 16MiB of them
+const size_t tiles_per_batch = 1024;
+
+//identifies a tile of samples anywhere in the plane, two views share tiles when everything but gx, gy matches
+typedef struct tile_key {
+    uint64_t delta_real; //bit patterns, the pixel size has to match exactly
+    uint64_t delta_img;
+    uint64_t max_itrs;
+    int64_t phase_x, phase_y; //in 1 / grid_phase_steps of a pixel
+    int64_t gx, gy; //tile position on the grid
+
+    bool operator==(const tile_key& other) const {
+        return delta_real == other.delta_real && delta_img == other.delta_img && max_itrs == other.max_itrs
+               && phase_x == other.phase_x && phase_y == other.phase_y && gx == other.gx && gy == other.gy;
+    }
+} tile_key;
+
+typedef struct tile_key_hash {
+    size_t operator()(const tile_key& key) const {
+        uint64_t hash = 0xcbf29ce484222325;
+        for (uint64_t part : {key.delta_real, key.delta_img, key.max_itrs, (uint64_t) key.phase_x,
+                              (uint64_t) key.phase_y, (uint64_t) key.gx, (uint64_t) key.gy})
+            hash = (hash ^ part) * 0x100000001b3;
+        return hash;
+    }
+} tile_key_hash;
+
+typedef struct cached_tile {
+    tile_key key;
+    uint32_t* pixels; //default_tile_size squared colours
+} cached_tile;
+
+//least recently used at the back
+typedef struct tile_cache {
+    size_t capacity; //tiles
+    std::list<cached_tile> tiles;
+    std::unordered_map<tile_key, std::list<cached_tile>::iterator, tile_key_hash> index;
+    size_t hits;
+    size_t misses;
+} tile_cache;
+
+static const uint32_t* cache_find(tile_cache& cache, const tile_key& key) {
+    auto const found = cache.index.find(key);
+    if (found == cache.index.end()) {
+        cache.misses++;
+        return nullptr;
+    }
+    cache.hits++;
+    cache.tiles.splice(cache.tiles.begin(), cache.tiles, found->second);
+    return found->second->pixels;
+}
+
+//takes ownership of pixels
+static void cache_insert(tile_cache& cache, const tile_key& key, uint32_t* pixels) {
+    if (cache.capacity == 0 || cache.index.count(key)) {
+        delete[] pixels;
+        return;
+    }
+    while (cache.tiles.size() >= cache.capacity) {
+        cache.index.erase(cache.tiles.back().key);
+        delete[] cache.tiles.back().pixels;
+        cache.tiles.pop_back();
+    }
+    cache.tiles.push_front({key, pixels});
+    cache.index[key] = cache.tiles.begin();
+}
+
+typedef struct serve_job {
+    size_t id;
+    int priority; //higher runs first
+    complex_t left_top;
+    complex_t right_bottom;
+    size_t width;
+    size_t height;
+    size_t max_itrs;
+    std::string output;
+    int client; //-1 once it has hung up
+    std::atomic<bool> cancelled;
+} serve_job;
+
+typedef struct server {
+    thread_pool* pool;
+    mtx_t lock; //everything below, and every send so replies don't interleave
+    cnd_t job_ready;
+    std::vector<serve_job*> queue;
+    serve_job* running;
+    size_t next_id;
+    bool stopping;
+    tile_cache cache;
+} server;
+
+static void send_line(int client, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void send_line(int client, const char* format, ...) {
+    if (client < 0)
+        return;
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int const length = vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+    size_t size = std::min((size_t) std::max(length, 0), sizeof(line) - 2);
+    line[size++] = '\n';
+    //client sockets are non-blocking, since this is called with the lock held, and a client that has let its
+    //socket fill up is hung up on rather than left to stall the job thread and the poll loop behind it
+    for (size_t sent = 0; sent < size;) {
+        ssize_t const written = send(client, line + sent, size - sent, MSG_NOSIGNAL);
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            shutdown(client, SHUT_RDWR);
+            return;
+        }
+        if (written <= 0 && errno != EINTR)
+            return; //a client that went away is noticed by the poll loop
+        if (written > 0)
+            sent += written;
+    }
+}
+
+//One pass over a batch of the tiles a job didn't find in the cache, each thread takes whichever is next and only
+//allocates it once it has
+typedef struct missing_tile {
+    tile_key key;
+    uint32_t* pixels;
+    bool done; //false if the job was cancelled first
+} missing_tile;
+
+typedef struct tile_pass {
+    std::vector<missing_tile>* tiles;
+    std::atomic<size_t> next;
+    const std::atomic<bool>* cancelled;
+    view_map<complex_t::value_type> grid; //pixel (0, 0) of the sample grid is 0 + 0i
+    size_t max_itrs;
+} tile_pass;
+
+typedef struct tile_pass_args {
+    tile_pass* pass;
+    sample_counts counts; //out
+} tile_pass_args;
+
+static int compute_missing_tiles(void* args) {
+    auto* pargs = (tile_pass_args*) args;
+    tile_pass& pass = *pargs->pass;
+    sample_counts counts{0, 0};
+    for (size_t i = pass.next++; i < pass.tiles->size() && !*pass.cancelled; i = pass.next++) {
+        missing_tile& tile = (*pass.tiles)[i];
+        tile.pixels = new uint32_t[default_tile_size * default_tile_size];
+        double const phase_x = tile.key.phase_x / grid_phase_steps;
+        double const phase_y = tile.key.phase_y / grid_phase_steps;
+        size_t y = 0;
+        for (; y < default_tile_size && !*pass.cancelled; y++) { //deep tiles can take a while, so rows check too
+            double const grid_y = (double) (tile.key.gy * (int64_t) default_tile_size + (int64_t) y) + phase_y;
+            complex_t::value_type const c_img = pass.grid.imag_at(grid_y);
+            for (size_t x = 0; x < default_tile_size; x++) {
+                double const grid_x = (double) (tile.key.gx * (int64_t) default_tile_size + (int64_t) x) + phase_x;
+                tile.pixels[y * default_tile_size + x] = sample_colour(complex_t{pass.grid.real_at(grid_x), c_img},
+                                                                       pass.max_itrs, counts);
+            }
+        }
+        tile.done = y == default_tile_size;
+    }
+    pargs->counts = counts;
+    return 0;
+}
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+//splits a coordinate measured in pixels into a whole grid pixel and a rounded sub-pixel phase
+static void grid_origin(double pixels, int64_t& origin, int64_t& phase) {
+    origin = (int64_t) std::floor(pixels);
+    phase = std::llround((pixels - origin) * grid_phase_steps);
+    if (phase == (int64_t) grid_phase_steps)
+        origin++, phase = 0;
+}
+
+//fills pixels with the job's image, from the cache where it can. Returns false if it was cancelled part way
+static bool render_job(server& serv, serve_job& job, uint32_t* pixels, sample_counts& counts) {
+    view_map<complex_t::value_type> const view(job.left_top, job.right_bottom, job.width, job.height);
+    //where the view's first pixel sits on the grid, whose y grows downwards like the image's
+    int64_t origin_x, origin_y, phase_x, phase_y;
+    grid_origin(-view.x_at(0), origin_x, phase_x);
+    grid_origin(-view.y_at(0), origin_y, phase_y);
+
+    auto const tile = (int64_t) default_tile_size;
+    int64_t const first_gx = floor_div(origin_x, tile), end_gx = floor_div(origin_x + (int64_t) job.width - 1, tile) + 1;
+    int64_t const first_gy = floor_div(origin_y, tile), end_gy = floor_div(origin_y + (int64_t) job.height - 1, tile) + 1;
+
+    //copies the part of a grid tile that falls inside the image
+    auto place = [&](const tile_key& key, const uint32_t* tile_pixels) {
+        int64_t const x0 = std::max(key.gx * tile, origin_x), x1 = std::min(key.gx * tile + tile, origin_x + (int64_t) job.width);
+        int64_t const y0 = std::max(key.gy * tile, origin_y), y1 = std::min(key.gy * tile + tile, origin_y + (int64_t) job.height);
+        for (int64_t y = y0; y < y1; y++)
+            memcpy(pixels + (y - origin_y) * job.width + (x0 - origin_x),
+                   tile_pixels + (y - key.gy * tile) * tile + (x0 - key.gx * tile), (x1 - x0) * sizeof(uint32_t));
+    };
+
+    std::vector<tile_key> missing;
+    mtx_lock(&serv.lock);
+    for (int64_t gy = first_gy; gy < end_gy; gy++) {
+        for (int64_t gx = first_gx; gx < end_gx; gx++) {
+            tile_key const key{std::bit_cast<uint64_t>((double) view.delta_real),
+                               std::bit_cast<uint64_t>((double) view.delta_img), job.max_itrs, phase_x, phase_y, gx, gy};
+            if (const uint32_t* cached = cache_find(serv.cache, key))
+                place(key, cached);
+            else
+                missing.push_back(key);
+        }
+    }
+    mtx_unlock(&serv.lock);
+
+    //a batch at a time, each into the image and the cache before the next, so a cold job only holds a batch of tiles
+    //on top of its image. Tiles finished before a cancel are still good for the next job
+    std::vector<missing_tile> batch;
+    std::vector<tile_pass_args> args(serv.pool->size());
+    for (size_t first = 0; first < missing.size() && !job.cancelled; first += tiles_per_batch) {
+        batch.clear();
+        for (size_t i = first; i < std::min(first + tiles_per_batch, missing.size()); i++)
+            batch.push_back({missing[i], nullptr, false});
+        tile_pass pass{&batch, {0}, &job.cancelled, view.anchored_at(0, 0), job.max_itrs};
+        std::fill(args.begin(), args.end(), tile_pass_args{&pass, {0, 0}});
+        serv.pool->run(&compute_missing_tiles, args.data());
+        for (const tile_pass_args& a : args) {
+            counts.itrs += a.counts.itrs;
+            counts.shortcuts += a.counts.shortcuts;
+        }
+
+        mtx_lock(&serv.lock);
+        for (missing_tile& m : batch) {
+            if (m.done) {
+                place(m.key, m.pixels);
+                cache_insert(serv.cache, m.key, m.pixels);
+            } else {
+                delete[] m.pixels;
+            }
+        }
+        mtx_unlock(&serv.lock);
+    }
+    return !job.cancelled;
+}
+
+static int job_worker(void* arg) {
+    auto& serv = *(server*) arg;
+    uint32_t* pixels = nullptr; //kept between jobs, only grows
+    size_t pixels_bytes = 0;
+
+    mtx_lock(&serv.lock);
+    while (true) {
+        while (!serv.stopping && serv.queue.empty())
+            cnd_wait(&serv.job_ready, &serv.lock);
+        if (serv.stopping)
+            break;
+        auto const next = std::min_element(serv.queue.begin(), serv.queue.end(), [](serve_job* a, serve_job* b) {
+            return a->priority != b->priority ? a->priority > b->priority : a->id < b->id;
+        });
+        serve_job* job = *next;
+        serv.queue.erase(next);
+        serv.running = job;
+        mtx_unlock(&serv.lock);
+
+        double const start = wall_now();
+        size_t const bytes = job->width * job->height * sizeof(uint32_t);
+        if (bytes > pixels_bytes) {
+            big_free(pixels, pixels_bytes);
+            pixels = (uint32_t*) big_alloc(bytes);
+            pixels_bytes = pixels ? bytes : 0;
+        }
+        sample_counts counts{0, 0};
+        bool const finished = pixels && render_job(serv, *job, pixels, counts);
+        unsigned error = 0;
+        size_t bytes_written = 0;
+        if (finished) {
+            stage_times times{};
+            output_method method;
+            error = write_png(job->output.c_str(), pixels, job->width, job->height, times, bytes_written, method);
+        }
+        double const taken = wall_now() - start;
+
+        mtx_lock(&serv.lock);
+        if (!pixels)
+            send_line(job->client, "failed %zu could not allocate the image", job->id);
+        else if (!finished)
+            send_line(job->client, "cancelled %zu", job->id);
+        else if (error)
+            send_line(job->client, "failed %zu %s", job->id, lodepng_error_text(error));
+        else
+            send_line(job->client, "done %zu %zu %f", job->id, bytes_written, taken);
+        printf("Job %zu %s after %f, %zu iterations\n", job->id, !finished ? "stopped" : error ? "failed" : "done",
+               taken, counts.itrs);
+        fflush(stdout);
+        serv.running = nullptr;
+        delete job;
+    }
+    mtx_unlock(&serv.lock);
+    big_free(pixels, pixels_bytes);
+    return 0;
+}
+
+//replies to one command line from client, returns false for shutdown
+static bool handle_command(server& serv, int client, const char* line) {
+    char command[16] = {};
+    int consumed = 0;
+    if (sscanf(line, "%15s%n", command, &consumed) != 1)
+        return true;
+    const char* rest = line + consumed;
+
+    if (strcmp(command, "render") == 0) {
+        int priority;
+        double coords[4];
+        size_t width, height, max_itrs;
+        int path_start = 0;
+        if (sscanf(rest, "%d %lf %lf %lf %lf %zu %zu %zu %n", &priority, &coords[0], &coords[1], &coords[2], &coords[3],
+                   &width, &height, &max_itrs, &path_start) != 8 || path_start == 0 || rest[path_start] == '\0') {
+            mtx_lock(&serv.lock);
+            send_line(client, "error render takes priority C1x C1y C2x C2y width height itrs output_path");
+            mtx_unlock(&serv.lock);
+            return true;
+        }
+        if (width == 0 || height == 0 || width > max_job_pixels / height || max_itrs == 0
+                || !(coords[2] > coords[0]) || !(coords[1] > coords[3])) {
+            mtx_lock(&serv.lock);
+            send_line(client, "error bad size, itrs or view");
+            mtx_unlock(&serv.lock);
+            return true;
+        }
+        auto* job = new serve_job{0, priority, {coords[0], coords[1]}, {coords[2], coords[3]}, width, height, max_itrs,
+                                  rest + path_start, client, {false}};
+        mtx_lock(&serv.lock);
+        job->id = serv.next_id++;
+        serv.queue.push_back(job);
+        send_line(client, "queued %zu", job->id);
+        cnd_signal(&serv.job_ready);
+        mtx_unlock(&serv.lock);
+    } else if (strcmp(command, "cancel") == 0) {
+        size_t id = 0;
+        bool found = false;
+        sscanf(rest, "%zu", &id);
+        mtx_lock(&serv.lock);
+        for (auto job = serv.queue.begin(); job != serv.queue.end(); ++job) {
+            if ((*job)->id == id) {
+                send_line((*job)->client, "cancelled %zu", id);
+                delete *job;
+                serv.queue.erase(job);
+                found = true;
+                break;
+            }
+        }
+        if (!found && serv.running && serv.running->id == id) {
+            serv.running->cancelled = true; //the worker replies once the pass stops
+            found = true;
+        }
+        send_line(client, found ? "cancelling %zu" : "unknown %zu", id);
+        mtx_unlock(&serv.lock);
+    } else if (strcmp(command, "status") == 0) {
+        mtx_lock(&serv.lock);
+        std::string const running = serv.running ? std::to_string(serv.running->id) : "-";
+        send_line(client, "status queued %zu running %s cache %zu %.1f %zu %zu", serv.queue.size(), running.c_str(),
+                  serv.cache.tiles.size(),
+                  serv.cache.tiles.size() * default_tile_size * default_tile_size * sizeof(uint32_t) / 1048576.0,
+                  serv.cache.hits, serv.cache.misses);
+        mtx_unlock(&serv.lock);
+    } else if (strcmp(command, "shutdown") == 0) {
+        mtx_lock(&serv.lock);
+        send_line(client, "bye");
+        mtx_unlock(&serv.lock);
+        return false;
+    } else {
+        mtx_lock(&serv.lock);
+        send_line(client, "error unknown command %s", command);
+        mtx_unlock(&serv.lock);
+    }
+    return true;
+}
+
+//nobody is left to collect a hung up client's images, so its jobs go
+static void drop_client(server& serv, int client) {
+    mtx_lock(&serv.lock);
+    for (auto job = serv.queue.begin(); job != serv.queue.end();) {
+        if ((*job)->client == client) {
+            delete *job;
+            job = serv.queue.erase(job);
+        } else {
+            ++job;
+        }
+    }
+    if (serv.running && serv.running->client == client) {
+        serv.running->client = -1;
+        serv.running->cancelled = true;
+    }
+    close(client);
+    mtx_unlock(&serv.lock);
+}
+
+int serve(const char* socket_path, thread_pool& pool, size_t cache_mb) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", socket_path);
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+    int const listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path); //left behind by a daemon that was killed
+    if (listener < 0 || bind(listener, (sockaddr*) &address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        fprintf(stderr, "Could not listen on %s: %s\n", socket_path, strerror(errno));
+        if (listener >= 0)
+            close(listener);
+        return 1;
+    }
+
+    server serv{};
+    serv.pool = &pool;
+    serv.next_id = 1;
+    serv.cache.capacity = cache_mb * 1048576 / (default_tile_size * default_tile_size * sizeof(uint32_t));
+    mtx_init(&serv.lock, mtx_plain);
+    cnd_init(&serv.job_ready);
+    thrd_t worker;
+    if (thrd_create(&worker, &job_worker, &serv) != thrd_success) {
+        fprintf(stderr, "Could not start the job thread\n");
+        close(listener);
+        unlink(socket_path);
+        return 1;
+    }
+    printf("Serving on %s with %zu threads and a %zu MiB tile cache\n", socket_path, pool.size(), cache_mb);
+    fflush(stdout);
+
+    std::vector<pollfd> fds{{listener, POLLIN, 0}};
+    std::vector<std::string> pending{""}; //partial lines, one per entry in fds
+    bool running = true;
+    while (running) {
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            int const client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK);
+            if (client >= 0) {
+                fds.push_back({client, POLLIN, 0});
+                pending.emplace_back();
+            }
+        }
+        for (size_t i = 1; running && i < fds.size(); i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            char buffer[4096];
+            ssize_t const got = read(fds[i].fd, buffer, sizeof(buffer));
+            if (got < 0 && (errno == EAGAIN || errno == EINTR))
+                continue;
+            if (got <= 0 || pending[i].size() > max_command_length) {
+                drop_client(serv, fds[i].fd);
+                fds.erase(fds.begin() + i);
+                pending.erase(pending.begin() + i);
+                i--;
+                continue;
+            }
+            pending[i].append(buffer, got);
+            for (size_t end; running && (end = pending[i].find('\n')) != std::string::npos;) {
+                std::string line = pending[i].substr(0, end);
+                pending[i].erase(0, end + 1);
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                running = handle_command(serv, fds[i].fd, line.c_str());
+            }
+        }
+    }
+
+    mtx_lock(&serv.lock);
+    serv.stopping = true;
+    if (serv.running)
+        serv.running->cancelled = true;
+    for (serve_job* job : serv.queue) {
+        send_line(job->client, "cancelled %zu", job->id);
+        delete job;
+    }
+    serv.queue.clear();
+    cnd_signal(&serv.job_ready);
+    mtx_unlock(&serv.lock);
+    thrd_join(worker, nullptr);
+
+    for (size_t i = 1; i < fds.size(); i++)
+        close(fds[i].fd);
+    close(listener);
+    unlink(socket_path);
+    for (cached_tile& tile : serv.cache.tiles)
+        delete[] tile.pixels;
+    mtx_destroy(&serv.lock);
+    cnd_destroy(&serv.job_ready);
+    printf("Served %zu jobs, tile cache hits %zu misses %zu\n", serv.next_id - 1, serv.cache.hits, serv.cache.misses);
+    return 0;
+}
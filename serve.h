@@ -0,0 +1,29 @@
+#ifndef FRACTALFUN_SERVE_H
+#define FRACTALFUN_SERVE_H
+
+#include <cstddef>
+
+#include "thread_pool.h"
+
+const size_t default_serve_cache_mb = 256;
+
+/*
+ * Long running render daemon listening on a Unix domain socket, so the pool, the image buffer and already computed
+ * tiles are kept between renders instead of paid for by a fresh process each time. Clients send one command per line:
+ *   render priority C1x C1y C2x C2y width height itrs output_path
+ *       replies "queued id", then "done id bytes seconds", "cancelled id" or "failed id reason" once it has run
+ *   cancel id    replies "cancelling id" or "unknown id", works on queued and running jobs
+ *   status       replies "status queued n running id|- cache tiles MiB hits misses"
+ *   shutdown     replies "bye", cancels everything and stops the daemon
+ * Bad commands get "error reason". Jobs run one at a time across the whole pool, highest priority first and oldest
+ * first within a priority, and a running job stops at its next tile once cancelled or once its client hangs up.
+ * Output paths are relative to the daemon's working directory. A client that stops reading its replies until its
+ * socket buffer is full is disconnected, and its jobs go with it.
+ *
+ * Tiles are computed on a grid shared by every view with the same pixel size, itrs and sub-pixel offset, and the
+ * last cache_mb worth are kept, so an explorer panning or redrawing overlapping views only computes what is new.
+ * Returns 0 after a shutdown command.
+ */
+int serve(const char* socket_path, thread_pool& pool, size_t cache_mb);
+
+#endif //FRACTALFUN_SERVE_H
@@ -0,0 +1,268 @@
+#include "thread_pool.h"
+
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sched.h>
+
+#include "timing.h"
+#include "trace.h"
+
+typedef struct worker_start {
+    thread_pool* pool;
+    size_t index;
+} worker_start;
+
+thread_pool::thread_pool(size_t num_threads, bool pin) : num_threads(num_threads ? num_threads : 1), thread_ids(nullptr),
+        generation(0), running(0), stopping(false), func(nullptr), args(nullptr), args_stride(0),
+        stats(nullptr), pin_cpus(nullptr) {
+    mtx_init(&lock, mtx_plain);
+    cnd_init(&work_ready);
+    cnd_init(&work_done);
+
+    stats = new thread_stats[this->num_threads];
+    reset_stats();
+
+    if (pin) {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+            //more threads than cpus just wraps around, which is the user's call to make
+            pin_cpus = new int[this->num_threads];
+            size_t found = 0;
+            for (int cpu = 0; cpu < CPU_SETSIZE && found < this->num_threads; cpu++)
+                if (CPU_ISSET(cpu, &allowed))
+                    pin_cpus[found++] = cpu;
+            for (size_t i = found; i < this->num_threads && found > 0; i++)
+                pin_cpus[i] = pin_cpus[i % found];
+            pin_self(0);
+        } else {
+            fprintf(stderr, "Couldn't read this process's cpu affinity, not pinning threads\n");
+        }
+    }
+
+    trace_name_thread("main, pool thread 0");
+    thread_ids = new thrd_t[this->num_threads - 1];
+    for (size_t i = 1; i < this->num_threads; i++) { //Using the main thread to do the first pool after
+        auto* start = new worker_start{this, i}; //worker frees it
+        if (thrd_create(&thread_ids[i - 1], &worker, start) == thrd_error) {
+            fprintf(stderr, "Failed to create thread num %zu, exiting\n", i);
+            exit(1);
+        }
+    }
+}
+
+thread_pool::~thread_pool() {
+    mtx_lock(&lock);
+    stopping = true;
+    cnd_broadcast(&work_ready);
+    mtx_unlock(&lock);
+
+    for (size_t i = 0; i < num_threads - 1; i++)
+        thrd_join(thread_ids[i], nullptr);
+    delete[] thread_ids;
+    delete[] stats;
+    delete[] pin_cpus;
+
+    cnd_destroy(&work_done);
+    cnd_destroy(&work_ready);
+    mtx_destroy(&lock);
+}
+
+int thread_pool::worker(void* pool_and_index) {
+    auto* start = (worker_start*) pool_and_index;
+    thread_pool* pool = start->pool;
+    size_t const index = start->index;
+    delete start;
+    pool->pin_self(index);
+    char name[32];
+    snprintf(name, sizeof(name), "pool thread %zu", index);
+    trace_name_thread(name);
+
+    size_t seen = 0;
+    while (true) {
+        mtx_lock(&pool->lock);
+        while (!pool->stopping && pool->generation == seen)
+            cnd_wait(&pool->work_ready, &pool->lock);
+        if (pool->stopping) {
+            mtx_unlock(&pool->lock);
+            return 0;
+        }
+        seen = pool->generation;
+        int (*func)(void*) = pool->func;
+        void* args = pool->args + index * pool->args_stride;
+        mtx_unlock(&pool->lock);
+
+        pool->run_one(index, func, args);
+
+        mtx_lock(&pool->lock);
+        if (--pool->running == 0)
+            cnd_signal(&pool->work_done);
+        mtx_unlock(&pool->lock);
+    }
+}
+
+void thread_pool::run_raw(int (*func)(void*), void* args, size_t args_stride) {
+    mtx_lock(&lock);
+    this->func = func;
+    this->args = (char*) args;
+    this->args_stride = args_stride;
+    running = num_threads - 1;
+    generation++;
+    cnd_broadcast(&work_ready);
+    mtx_unlock(&lock);
+
+    run_one(0, func, args);
+
+    mtx_lock(&lock);
+    while (running != 0)
+        cnd_wait(&work_done, &lock);
+    mtx_unlock(&lock);
+}
+
+void thread_pool::pin_self(size_t index) {
+    if (!pin_cpus)
+        return;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(pin_cpus[index], &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) //0 is the calling thread on linux
+        fprintf(stderr, "Failed to pin thread %zu to cpu %d\n", index, pin_cpus[index]);
+}
+
+void thread_pool::run_one(size_t index, int (*func)(void*), void* args) {
+    bool const counted = perf_counters_enabled();
+    counter_values const counters_start = counted ? thread_counters_now() : counter_values{};
+    uint64_t const trace_start = trace_now();
+    double const wall_start = wall_now();
+    double const cpu_start = thread_cpu_now();
+    func(args);
+    trace_span("pass", trace_start);
+    stats[index].busy_wall += wall_now() - wall_start;
+    stats[index].busy_cpu += thread_cpu_now() - cpu_start;
+    if (counted)
+        counters_add(stats[index].counters, counters_start, thread_counters_now());
+}
+
+void thread_pool::reset_stats() {
+    for (size_t i = 0; i < num_threads; i++)
+        stats[i] = {};
+}
+
+void thread_pool::print_stats(const char* stage, bool per_thread) const {
+    double min = stats[0].busy_wall, max = stats[0].busy_wall, total = 0;
+    counter_values counters{};
+    char label[64];
+    for (size_t i = 0; i < num_threads; i++) {
+        min = stats[i].busy_wall < min ? stats[i].busy_wall : min;
+        max = stats[i].busy_wall > max ? stats[i].busy_wall : max;
+        total += stats[i].busy_wall;
+        counters_sum(counters, stats[i].counters);
+        if (per_thread) {
+            printf("  %s thread %zu: busy %f wall, %f cpu\n", stage, i, stats[i].busy_wall, stats[i].busy_cpu);
+            snprintf(label, sizeof(label), "%s thread %zu counters", stage, i);
+            print_counters(label, stats[i].counters);
+        }
+    }
+    double const mean = total / num_threads;
+    //max / mean is how much longer the stage took than it would have with perfectly even work
+    printf("  %s threads: busy min %f, mean %f, max %f, imbalance %.2f\n", stage, min, mean, max, mean > 0 ? max / mean : 1.0);
+    snprintf(label, sizeof(label), "%s counters", stage);
+    print_counters(label, counters);
+}
+
+//whether a comma separated controller list, as in "cpu,cpuacct", has name in it
+static bool lists_controller(const char* controllers, const char* name) {
+    size_t const length = strlen(name);
+    for (const char* at = controllers; at; at = strchr(at, ',') ? strchr(at, ',') + 1 : nullptr)
+        if (strncmp(at, name, length) == 0 && (at[length] == ',' || at[length] == '\0'))
+            return true;
+    return false;
+}
+
+//cgroup v2 exposes "quota period" (or "max period") in cpu.max, v1 splits them over two files with -1 for no quota.
+//Both are read from the process's own cgroup as /proc/self/cgroup gives it, "0::path" for v2 and
+//"id:controllers:path" for the v1 hierarchy with the cpu controller, which is mounted under its controller list.
+//A line too long for the buffers means no quota, rather than falling back to the root's, which isn't ours
+static double cgroup_cpu_limit() {
+    char v2_path[PATH_MAX] = "", v1_path[PATH_MAX] = "";
+    bool v2 = false, v1 = false;
+    FILE* self = fopen("/proc/self/cgroup", "r");
+    if (!self)
+        return 0;
+    char line[PATH_MAX + 64]; //the id, the controllers, the path and the newline
+    while (fgets(line, sizeof(line), self)) {
+        size_t const length = strcspn(line, "\n");
+        if (line[length] != '\n') {
+            fclose(self);
+            return 0;
+        }
+        line[length] = '\0';
+        char* controllers = strchr(line, ':');
+        char* path = controllers ? strchr(controllers + 1, ':') : nullptr;
+        if (!path)
+            continue;
+        *controllers++ = '\0';
+        *path++ = '\0';
+        int written = 0;
+        if (strcmp(line, "0") == 0 && *controllers == '\0') {
+            v2 = true;
+            written = snprintf(v2_path, sizeof(v2_path), "/sys/fs/cgroup%s/cpu.max", path);
+        } else if (lists_controller(controllers, "cpu")) {
+            v1 = true;
+            written = snprintf(v1_path, sizeof(v1_path), "/sys/fs/cgroup/%s%s/", controllers, path);
+        }
+        if (written >= (int) PATH_MAX - 32) { //room for v1's file names
+            fclose(self);
+            return 0;
+        }
+    }
+    fclose(self);
+
+    //a hybrid setup has a v2 hierarchy without the cpu controller, so no cpu.max, alongside the v1 one that has it
+    FILE* file = v2 ? fopen(v2_path, "r") : nullptr;
+    if (file) {
+        char quota[32];
+        double period;
+        int read = fscanf(file, "%31s %lf", quota, &period);
+        fclose(file);
+        if (read == 2 && strcmp(quota, "max") != 0 && period > 0)
+            return strtod(quota, nullptr) / period;
+        return 0;
+    }
+    if (!v1)
+        return 0;
+
+    char path[PATH_MAX];
+    double quota = -1, period = 0;
+    snprintf(path, sizeof(path), "%scpu.cfs_quota_us", v1_path);
+    if ((file = fopen(path, "r"))) {
+        if (fscanf(file, "%lf", &quota) != 1)
+            quota = -1;
+        fclose(file);
+    }
+    snprintf(path, sizeof(path), "%scpu.cfs_period_us", v1_path);
+    if ((file = fopen(path, "r"))) {
+        if (fscanf(file, "%lf", &period) != 1)
+            period = 0;
+        fclose(file);
+    }
+    return quota > 0 && period > 0 ? quota / period : 0;
+}
+
+size_t default_thread_count() {
+    size_t count = 1;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        count = CPU_COUNT(&allowed);
+
+    //a fractional quota still gets a thread for the fraction, the scheduler sorts out the rest
+    double const limit = cgroup_cpu_limit();
+    if (limit > 0 && std::ceil(limit) < count)
+        count = (size_t) std::ceil(limit);
+    return count ? count : 1;
+}
@@ -0,0 +1,66 @@
+#ifndef FRACTALFUN_THREAD_POOL_H
+#define FRACTALFUN_THREAD_POOL_H
+
+#include <cstddef>
+
+#include <threads.h>
+
+#include "perf_counters.h"
+
+typedef struct thread_stats {
+    double busy_wall; //seconds spent inside run funcs since the last reset
+    double busy_cpu;
+    counter_values counters; //inside run funcs too, only counted when perf_counters_enabled
+} thread_stats;
+
+//Workers are spawned once and parked between passes, so a run costs a wake up rather than a thrd_create
+class thread_pool {
+private:
+    size_t num_threads;
+    thrd_t* thread_ids;
+
+    mtx_t lock;
+    cnd_t work_ready;
+    cnd_t work_done;
+    size_t generation; //bumped for every run so workers know there's something new
+    size_t running;
+    bool stopping;
+
+    int (*func)(void*);
+    char* args;
+    size_t args_stride;
+
+    thread_stats* stats; //each thread only ever writes its own
+    int* pin_cpus; //cpu for each thread to bind itself to, null when not pinning
+
+    void run_one(size_t index, int (*func)(void*), void* args);
+    void pin_self(size_t index);
+
+    static int worker(void* pool_and_index);
+    void run_raw(int (*func)(void*), void* args, size_t args_stride);
+
+public:
+    //pin binds each thread to its own cpu out of the ones this process is allowed on, in order
+    explicit thread_pool(size_t num_threads, bool pin = false);
+    ~thread_pool();
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    [[nodiscard]] size_t size() const {return num_threads;};
+    [[nodiscard]] bool pinned() const {return pin_cpus != nullptr;};
+
+    //runs func once per element of args, one per thread, with the calling thread taking args[0], returns when all are done
+    template<typename T>
+    void run(int (*func)(void*), T* args) {run_raw(func, args, sizeof(T));};
+
+    [[nodiscard]] const thread_stats& stats_for(size_t thread) const {return stats[thread];};
+    void reset_stats();
+    //busy time spread across the threads since the last reset, and their counters if counting, with each thread listed
+    //if per_thread
+    void print_stats(const char* stage, bool per_thread) const;
+};
+
+//cpus this process may actually use: its affinity mask, further capped by a cgroup cpu quota if there is one
+size_t default_thread_count();
+
+#endif //FRACTALFUN_THREAD_POOL_H
@@ -0,0 +1,59 @@
+#include "tile_costs.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "lodepng/lodepng.h"
+
+int write_tile_costs(const char* filename_base, const tile_cost* costs, const tile_scheduler& tiles,
+                     complex_t left_top, complex_t right_bottom, size_t img_width, size_t img_height, size_t max_itrs) {
+    size_t const columns = tiles.columns(), rows = tiles.rows();
+    size_t const num_tiles = columns * rows;
+    uint64_t slowest = 0, total_ns = 0, total_itrs = 0;
+    for (size_t i = 0; i < num_tiles; i++) {
+        slowest = std::max(slowest, costs[i].ns);
+        total_ns += costs[i].ns;
+        total_itrs += costs[i].itrs;
+    }
+
+    //linear rather than log, so a tile half as bright really did take half as long
+    std::vector<unsigned char> grey(num_tiles);
+    for (size_t i = 0; i < num_tiles; i++)
+        grey[i] = slowest ? (unsigned char) ((costs[i].ns * 255 + slowest / 2) / slowest) : 0;
+    char* filename;
+    asprintf(&filename, "%s (tile costs).png", filename_base);
+    unsigned const error = lodepng_encode_file(filename, grey.data(), columns, rows, LCT_GREY, 8);
+    if (error)
+        fprintf(stderr, "Failed to write %s: %s\n", filename, lodepng_error_text(error));
+    free(filename);
+
+    asprintf(&filename, "%s (tile costs).csv", filename_base);
+    FILE* csv = fopen(filename, "w");
+    if (!csv) {
+        fprintf(stderr, "Could not open %s for the tile costs\n", filename);
+        free(filename);
+        return 1;
+    }
+    fprintf(csv, "# view %.17g %.17g %.17g %.17g, %zupx x %zupx, %zu max itrs, %s\n", left_top.real(), left_top.imag(),
+            right_bottom.real(), right_bottom.imag(), img_width, img_height, max_itrs, type_name);
+    fprintf(csv, "# %zu x %zu tiles of %zupx, %llu iterations in %.6f thread seconds\n", columns, rows, tiles.size(),
+            (unsigned long long) total_itrs, total_ns * 1e-9);
+    fprintf(csv, "tile,column,row,x0,y0,width,height,iterations,ns,iterations_per_ns\n");
+    for (size_t i = 0; i < num_tiles; i++) {
+        size_t const column = i % columns, row = i / columns;
+        size_t const x0 = column * tiles.size(), y0 = row * tiles.size();
+        fprintf(csv, "%zu,%zu,%zu,%zu,%zu,%zu,%zu,%llu,%llu,%.4f\n", i, column, row, x0, y0,
+                std::min(tiles.size(), img_width - x0), std::min(tiles.size(), img_height - y0),
+                (unsigned long long) costs[i].itrs, (unsigned long long) costs[i].ns,
+                costs[i].ns ? (double) costs[i].itrs / costs[i].ns : 0.0);
+    }
+    bool const written = fclose(csv) == 0;
+    if (!written)
+        fprintf(stderr, "Failed writing %s\n", filename);
+    else
+        printf("Wrote tile costs to %s and its png\n", filename);
+    free(filename);
+    return error || !written ? 1 : 0;
+}
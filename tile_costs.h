@@ -0,0 +1,35 @@
+#ifndef FRACTALFUN_TILE_COSTS_H
+#define FRACTALFUN_TILE_COSTS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "complex_t.h"
+#include "tile_scheduler.h"
+#include "timing.h"
+
+//what one tile took, summed over every pass that computed samples in it
+typedef struct tile_cost {
+    uint64_t itrs;
+    uint64_t ns; //wall time of the thread that had the tile
+} tile_cost;
+
+//adds a tile's iterations and the time since start, a wall_now, if costs are being kept. Each tile is only ever
+//claimed by one thread in a pass, so nothing else is writing to its cost
+inline void add_tile_cost(tile_cost* tile_costs, size_t tile, size_t itrs, double start) {
+    if (!tile_costs)
+        return;
+    tile_costs[tile].itrs += itrs;
+    tile_costs[tile].ns += (uint64_t) ((wall_now() - start) * 1e9);
+}
+
+/*
+ * Writes the tile costs next to a render as "<filename_base> (tile costs).png", one grey pixel per tile with white
+ * the slowest tile, and "<filename_base> (tile costs).csv", a line per tile with its position, iterations and time,
+ * after a few # lines with the view so a cost estimate for a nearby view has what it needs. Returns 0 if both were
+ * written.
+ */
+int write_tile_costs(const char* filename_base, const tile_cost* costs, const tile_scheduler& tiles,
+                     complex_t left_top, complex_t right_bottom, size_t img_width, size_t img_height, size_t max_itrs);
+
+#endif //FRACTALFUN_TILE_COSTS_H
@@ -0,0 +1,59 @@
+#include "tile_scheduler.h"
+
+#include <algorithm>
+
+#include "trace.h"
+
+tile_scheduler::tile_scheduler(size_t img_width, size_t img_height, size_t num_bands, size_t tile_size) :
+        img_width(img_width), img_height(img_height), tile_size(tile_size),
+        tiles_x((img_width + tile_size - 1) / tile_size), tiles_y((img_height + tile_size - 1) / tile_size),
+        num_bands(num_bands ? num_bands : 1), bands(nullptr) {
+    bands = new band[this->num_bands];
+    for (size_t b = 0; b < this->num_bands; b++) {
+        bands[b].first = (tiles_y * b / this->num_bands) * tiles_x;
+        bands[b].end = (tiles_y * (b + 1) / this->num_bands) * tiles_x;
+    }
+    reset();
+}
+
+tile_scheduler::~tile_scheduler() {
+    delete[] bands;
+}
+
+void tile_scheduler::reset() {
+    for (size_t b = 0; b < num_bands; b++)
+        bands[b].next.store(bands[b].first, std::memory_order_relaxed);
+}
+
+bool tile_scheduler::claim(size_t thread, tile_t& tile) {
+    //own band first, then the next ones along so thieves spread out rather than all piling onto band 0
+    for (size_t offset = 0; offset < num_bands; offset++) {
+        band& b = bands[(thread + offset) % num_bands];
+        if (b.next.load(std::memory_order_relaxed) >= b.end)
+            continue;
+        size_t const index = b.next.fetch_add(1, std::memory_order_relaxed);
+        if (index >= b.end)
+            continue;
+
+        size_t const tx = index % tiles_x;
+        size_t const ty = index / tiles_x;
+        tile.index = index;
+        tile.x0 = tx * tile_size;
+        tile.y0 = ty * tile_size;
+        tile.x1 = std::min(tile.x0 + tile_size, img_width);
+        tile.y1 = std::min(tile.y0 + tile_size, img_height);
+        tile.stolen = offset != 0;
+        if (tile.stolen)
+            trace_instant("steal", "tile", (int64_t) index);
+        return true;
+    }
+    return false;
+}
+
+size_t tile_scheduler::band_first_row(size_t band) const {
+    return std::min(bands[band].first / tiles_x * tile_size, img_height);
+}
+
+size_t tile_scheduler::band_end_row(size_t band) const {
+    return std::min(bands[band].end / tiles_x * tile_size, img_height);
+}
@@ -0,0 +1,57 @@
+#ifndef FRACTALFUN_TILE_SCHEDULER_H
+#define FRACTALFUN_TILE_SCHEDULER_H
+
+#include <atomic>
+#include <cstddef>
+
+const size_t default_tile_size = 64; //has to stay a multiple of twice the coarsest refinement step
+
+typedef struct tile_t {
+    size_t index; //row major over the tile grid
+    size_t x0, y0; //inclusive
+    size_t x1, y1; //exclusive
+    bool stolen; //came from another thread's band
+} tile_t;
+
+/*
+ * Splits the image into square tiles and the tile rows into one contiguous band per thread. Each thread works
+ * through its own band first, which is the memory it first touched and so is local to it on NUMA machines, and only
+ * then steals tiles from the other bands so uneven work still balances out.
+ */
+class tile_scheduler {
+private:
+    struct alignas(64) band { //own cache line each so claiming doesn't bounce between threads
+        std::atomic<size_t> next;
+        size_t first;
+        size_t end;
+    };
+
+    size_t img_width;
+    size_t img_height;
+    size_t tile_size;
+    size_t tiles_x;
+    size_t tiles_y;
+    size_t num_bands;
+    band* bands;
+
+public:
+    tile_scheduler(size_t img_width, size_t img_height, size_t num_bands, size_t tile_size = default_tile_size);
+    ~tile_scheduler();
+    tile_scheduler(const tile_scheduler&) = delete;
+    tile_scheduler& operator=(const tile_scheduler&) = delete;
+
+    //makes every tile available again, call between passes while no thread is claiming
+    void reset();
+    //hands thread its next tile, false once every band is empty
+    bool claim(size_t thread, tile_t& tile);
+
+    //pixel rows [band_first_row, band_end_row) are the ones band's owner should first touch
+    [[nodiscard]] size_t band_first_row(size_t band) const;
+    [[nodiscard]] size_t band_end_row(size_t band) const;
+
+    [[nodiscard]] size_t size() const {return tile_size;};
+    [[nodiscard]] size_t columns() const {return tiles_x;};
+    [[nodiscard]] size_t rows() const {return tiles_y;};
+};
+
+#endif //FRACTALFUN_TILE_SCHEDULER_H
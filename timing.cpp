@@ -0,0 +1,57 @@
+#include "timing.h"
+
+#include <cstdio>
+#include <ctime>
+
+#include <sys/resource.h>
+
+const char* const stage_names[num_stages] = {"allocate", "compute", "antialias", "colour", "filter", "deflate", "write", "pipeline"};
+
+static double clock_seconds(clockid_t clock) {
+    struct timespec now{};
+    clock_gettime(clock, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+double wall_now() {
+    return clock_seconds(CLOCK_MONOTONIC);
+}
+
+double process_cpu_now() {
+    return clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+double thread_cpu_now() {
+    return clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+timing_point timing_now() {
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return {wall_now(), process_cpu_now(), (size_t) usage.ru_minflt, (size_t) usage.ru_majflt};
+}
+
+timing_point thread_timing_now() {
+    struct rusage usage{};
+    getrusage(RUSAGE_THREAD, &usage);
+    return {wall_now(), thread_cpu_now(), (size_t) usage.ru_minflt, (size_t) usage.ru_majflt};
+}
+
+void stage_add(stage_times& times, stage_id stage, double wall, double cpu, size_t minor_faults, size_t major_faults) {
+    times.wall[stage] += wall;
+    times.cpu[stage] += cpu;
+    times.minor_faults[stage] += minor_faults;
+    times.major_faults[stage] += major_faults;
+    times.used[stage] = true;
+}
+
+void print_stage_times(const stage_times& times) {
+    printf("%-10s %12s %12s %8s %10s %8s %12s\n", "stage", "wall (s)", "cpu (s)", "cpu/wall", "min flt", "maj flt", "copied (MB)");
+    for (size_t stage = 0; stage < num_stages; stage++) {
+        if (!times.used[stage])
+            continue;
+        printf("%-10s %12.6f %12.6f %8.2f %10zu %8zu %12.3f\n", stage_names[stage], times.wall[stage], times.cpu[stage],
+               times.wall[stage] > 0 ? times.cpu[stage] / times.wall[stage] : 0.0, times.minor_faults[stage],
+               times.major_faults[stage], times.bytes_copied[stage] * 1e-6);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef FRACTALFUN_TIMING_H
+#define FRACTALFUN_TIMING_H
+
+#include <cstddef>
+
+enum stage_id {
+    stage_allocate,
+    stage_compute,
+    stage_antialias,
+    stage_colour,
+    stage_filter, //everything lodepng_encode does other than deflate, mostly scanline filtering
+    stage_deflate,
+    stage_write,
+    stage_pipeline, //compute through write overlapped in one pass, the stages above are then summed over threads
+    num_stages
+};
+
+extern const char* const stage_names[num_stages];
+
+//a moment in both wall clock and CPU time, in seconds, along with the page faults taken so far
+typedef struct timing_point {
+    double wall;
+    double cpu; //whole process, so every thread's time is in it
+    size_t minor_faults;
+    size_t major_faults;
+} timing_point;
+
+typedef struct stage_times {
+    double wall[num_stages];
+    double cpu[num_stages];
+    size_t minor_faults[num_stages];
+    size_t major_faults[num_stages];
+    size_t bytes_copied[num_stages]; //moved through memory without being transformed, see stage_copied
+    bool used[num_stages];
+} stage_times;
+
+double wall_now();
+double process_cpu_now();
+double thread_cpu_now();
+timing_point timing_now();
+//cpu and faults for the calling thread only, for stages that run inside another one on the same thread
+timing_point thread_timing_now();
+
+void stage_add(stage_times& times, stage_id stage, double wall, double cpu, size_t minor_faults = 0, size_t major_faults = 0);
+inline void stage_add(stage_times& times, stage_id stage, timing_point start, timing_point stop) {
+    stage_add(times, stage, stop.wall - start.wall, stop.cpu - start.cpu, stop.minor_faults - start.minor_faults,
+              stop.major_faults - start.major_faults);
+}
+
+inline void stage_copied(stage_times& times, stage_id stage, size_t bytes) {
+    times.bytes_copied[stage] += bytes;
+}
+
+//one line per stage that was used, with CPU / wall as an effective thread count
+void print_stage_times(const stage_times& times);
+
+#endif //FRACTALFUN_TIMING_H
@@ -0,0 +1,120 @@
+#include "trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::atomic<bool> trace_enabled{false};
+
+typedef struct trace_event {
+    const char* name;
+    const char* arg_name; //null when there's no arg
+    uint64_t start;
+    uint64_t stop; //same as start for an instant
+    int64_t arg;
+} trace_event;
+
+//only its own thread writes to a ring, the dump reads them once the threads have finished their passes
+typedef struct trace_ring {
+    trace_event* events;
+    size_t recorded; //ever, so events[recorded % capacity] is the next slot and anything past capacity was lost
+    long tid;
+    char name[48];
+} trace_ring;
+
+static std::mutex rings_lock;
+static std::vector<trace_ring*> rings; //outlive their threads, so the dump still has a finished thread's events
+static size_t ring_capacity = default_trace_events;
+static uint64_t trace_origin;
+
+static thread_local trace_ring* own_ring = nullptr;
+
+uint64_t trace_clock() {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec + 1;
+}
+
+void trace_start(size_t events_per_thread) {
+    std::lock_guard<std::mutex> guard(rings_lock);
+    ring_capacity = events_per_thread ? events_per_thread : 1;
+    trace_origin = trace_clock();
+    trace_enabled = true;
+}
+
+static trace_ring* ring_for_thread() {
+    if (own_ring)
+        return own_ring;
+    auto* ring = new trace_ring{nullptr, 0, (long) syscall(SYS_gettid), {}};
+    snprintf(ring->name, sizeof(ring->name), "thread %ld", ring->tid);
+    std::lock_guard<std::mutex> guard(rings_lock);
+    ring->events = new trace_event[ring_capacity];
+    rings.push_back(ring);
+    own_ring = ring;
+    return ring;
+}
+
+void trace_record(const char* name, uint64_t start, uint64_t stop, const char* arg_name, int64_t arg) {
+    trace_ring* ring = ring_for_thread();
+    ring->events[ring->recorded++ % ring_capacity] = {name, arg_name, start, stop, arg};
+}
+
+void trace_name_thread(const char* name) {
+    if (!tracing())
+        return;
+    trace_ring* ring = ring_for_thread();
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+}
+
+//microseconds since trace_start, which is what the format wants, to the nanosecond
+static double trace_us(uint64_t time) {
+    return time > trace_origin ? (time - trace_origin) * 1e-3 : 0;
+}
+
+int write_trace_json(const char* path) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Could not open %s for the trace\n", path);
+        return 1;
+    }
+    std::lock_guard<std::mutex> guard(rings_lock);
+    size_t dropped = 0, written = 0;
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    const char* separator = "";
+    for (const trace_ring* ring : rings) {
+        //names are ours, so nothing in them needs escaping
+        fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %ld, \"args\": {\"name\": \"%s\"}}",
+                separator, ring->tid, ring->name);
+        separator = ",\n";
+        size_t const first = ring->recorded > ring_capacity ? ring->recorded - ring_capacity : 0;
+        dropped += first;
+        for (size_t i = first; i < ring->recorded; i++) {
+            const trace_event& event = ring->events[i % ring_capacity];
+            if (event.stop == event.start)
+                fprintf(out, "%s{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": 1, \"tid\": %ld",
+                        separator, event.name, trace_us(event.start), ring->tid);
+            else
+                fprintf(out, "%s{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %ld",
+                        separator, event.name, trace_us(event.start), (event.stop - event.start) * 1e-3, ring->tid);
+            if (event.arg_name)
+                fprintf(out, ", \"args\": {\"%s\": %lld}", event.arg_name, (long long) event.arg);
+            fputc('}', out);
+            written++;
+        }
+    }
+    fprintf(out, "\n], \"otherData\": {\"dropped_events\": %zu}}\n", dropped);
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Failed writing the trace to %s\n", path);
+        return 1;
+    }
+    if (dropped)
+        fprintf(stderr, "The trace lost its %zu oldest events to full buffers, a bigger -trace-events would keep them\n",
+                dropped);
+    printf("Wrote %zu trace events from %zu threads to %s\n", written, rings.size(), path);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef FRACTALFUN_TRACE_H
+#define FRACTALFUN_TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//events kept per thread, older ones are overwritten once a thread has recorded more, 40 bytes each
+const size_t default_trace_events = (size_t) 1 << 16;
+
+/*
+ * An opt in timeline of what every thread was doing, for when a render is slow and it isn't obvious whether threads
+ * sat idle or a few tiles were just expensive. Each thread records into its own ring buffer, so recording is a clock
+ * read and a store with no locking, and with tracing off every call is a single relaxed load. Spans are recorded when
+ * they finish, as a name, start and end, and an optional number such as the tile index. Names have to be string
+ * literals, or at least outlive the trace, since only the pointer is kept. write_trace_json dumps every thread's
+ * events in Chrome's trace event format, which chrome://tracing and ui.perfetto.dev both open.
+ */
+extern std::atomic<bool> trace_enabled;
+
+//starts recording, from every thread, until the process exits
+void trace_start(size_t events_per_thread = default_trace_events);
+inline bool tracing() {return trace_enabled.load(std::memory_order_relaxed);}
+
+//monotonic nanoseconds, never 0
+uint64_t trace_clock();
+void trace_record(const char* name, uint64_t start, uint64_t stop, const char* arg_name, int64_t arg);
+
+//the start of a span, or 0 when not tracing so the span is dropped without reading the clock again
+inline uint64_t trace_now() {return tracing() ? trace_clock() : 0;}
+//ends a span started with trace_now, arg_name labels arg in the trace when not null
+inline void trace_span(const char* name, uint64_t start, const char* arg_name = nullptr, int64_t arg = 0) {
+    if (start)
+        trace_record(name, start, trace_clock(), arg_name, arg);
+}
+//a moment rather than a span, like a tile being stolen
+inline void trace_instant(const char* name, const char* arg_name = nullptr, int64_t arg = 0) {
+    if (tracing()) {
+        uint64_t const now = trace_clock();
+        trace_record(name, now, now, arg_name, arg);
+    }
+}
+
+//what the calling thread is shown as, copied, so it can be a temporary
+void trace_name_thread(const char* name);
+
+//returns 0 on success, with a note on stderr if any thread's ring wrapped and lost its oldest events
+int write_trace_json(const char* path);
+
+#endif //FRACTALFUN_TRACE_H
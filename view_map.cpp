@@ -0,0 +1,124 @@
+#include "view_map.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <unistd.h>
+
+//pairs mapped at a time, enough that the per line cost is just parsing and printing
+const size_t view_map_batch = 4096;
+const size_t view_map_read_bytes = 65536;
+
+template<typename T>
+static T parse_value(const char* text, char** end) {
+    if constexpr (sizeof(T) > sizeof(double))
+        return strtold(text, end);
+    else
+        return strtod(text, end);
+}
+
+static bool parse_pair(const char* line, long double& first, long double& second, bool extended) {
+    char* end;
+    first = extended ? parse_value<long double>(line, &end) : parse_value<double>(line, &end);
+    if (end == line)
+        return false;
+    const char* at = end;
+    second = extended ? parse_value<long double>(at, &end) : parse_value<double>(at, &end);
+    return end != at;
+}
+
+template<typename T>
+static void write_batch(const view_map<T>& map, std::vector<T>& pairs, bool to_pixels, FILE* out) {
+    size_t const count = pairs.size() / 2;
+    if (to_pixels)
+        points_to_pixels(map, pairs.data(), count, pairs.data());
+    else
+        pixels_to_points(map, pairs.data(), count, pairs.data());
+    //widening to long double for printing is exact, and max_digits10 of T is enough to parse back to the same T
+    int const digits = std::numeric_limits<T>::max_digits10;
+    for (size_t i = 0; i < count; i++)
+        fprintf(out, "%.*Lg %.*Lg\n", digits, (long double) pairs[2 * i], digits, (long double) pairs[2 * i + 1]);
+    pairs.clear();
+}
+
+template<typename T>
+static int stream_pairs(const char* const view[4], size_t img_width, size_t img_height, bool to_pixels, int in,
+                        FILE* out) {
+    T coords[4];
+    for (size_t i = 0; i < 4; i++)
+        coords[i] = parse_value<T>(view[i], nullptr);
+    view_map<T> const map(coords[0], coords[1], coords[2], coords[3], img_width, img_height);
+
+    int status = 0;
+    size_t line_num = 0;
+    std::vector<T> pairs;
+    pairs.reserve(2 * view_map_batch);
+    auto add_line = [&](const char* line) {
+        line_num++;
+        if (line[strspn(line, " \t\r")] == '\0')
+            return;
+        long double first, second;
+        if (!parse_pair(line, first, second, sizeof(T) > sizeof(double))) {
+            fprintf(stderr, "Line %zu isn't a pair of numbers\n", line_num);
+            first = second = NAN;
+            status = 1;
+        }
+        pairs.push_back((T) first);
+        pairs.push_back((T) second);
+        if (pairs.size() == 2 * view_map_batch)
+            write_batch(map, pairs, to_pixels, out);
+    };
+
+    //read() rather than stdio so a batch is whatever has arrived so far, and a caller sending a line at a time gets
+    //its answer straight away instead of once the batch fills up
+    std::vector<char> buffer(view_map_read_bytes);
+    size_t held = 0; //start of a line that hasn't ended yet, moved to the front of buffer
+    for (;;) {
+        if (held == buffer.size())
+            buffer.resize(2 * buffer.size());
+        ssize_t const got = read(in, buffer.data() + held, buffer.size() - held);
+        if (got < 0 && errno == EINTR)
+            continue;
+        size_t const filled = held + (got > 0 ? got : 0);
+        size_t start = 0;
+        for (size_t i = held; i < filled; i++) {
+            if (buffer[i] != '\n')
+                continue;
+            buffer[i] = '\0';
+            add_line(buffer.data() + start);
+            start = i + 1;
+        }
+        if (got <= 0) { //the last line can do without its newline
+            if (start < filled) {
+                buffer.resize(filled + 1);
+                buffer[filled] = '\0';
+                add_line(buffer.data() + start);
+            }
+            if (got < 0) {
+                perror("Reading lines to map");
+                status = 1;
+            }
+            break;
+        }
+        memmove(buffer.data(), buffer.data() + start, filled - start);
+        held = filled - start;
+        write_batch(map, pairs, to_pixels, out);
+        fflush(out);
+    }
+    write_batch(map, pairs, to_pixels, out);
+    fflush(out);
+    return status;
+}
+
+int stream_view_map(const char* const view[4], size_t img_width, size_t img_height, bool to_pixels, bool extended,
+                    int in, FILE* out) {
+    if (img_width == 0 || img_height == 0)
+        return 1;
+    if (extended)
+        return stream_pairs<long double>(view, img_width, img_height, to_pixels, in, out);
+    return stream_pairs<complex_t::value_type>(view, img_width, img_height, to_pixels, in, out);
+}
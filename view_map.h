@@ -0,0 +1,76 @@
+#ifndef FRACTALFUN_VIEW_MAP_H
+#define FRACTALFUN_VIEW_MAP_H
+
+#include <cstddef>
+#include <cstdio>
+
+#include "complex_t.h"
+
+/*
+ * The pixel grid of a view, placing pixel (x, y) at left_real + x * delta_real, top_imag - y * delta_img with the
+ * deltas worked out once per view, which is exactly the arithmetic the kernels use to pick c. T is the precision,
+ * complex_t::value_type to land on the same c the kernels do, long double for selections deeper than double can tell
+ * apart. Fractional pixels are fine, pixel centres are at + 0.5.
+ */
+template<typename T>
+struct view_map {
+    T left_real;
+    T top_imag;
+    T delta_real;
+    T delta_img;
+
+    view_map(T left_real, T top_imag, T right_real, T bottom_imag, size_t img_width, size_t img_height)
+            : left_real(left_real), top_imag(top_imag), delta_real((right_real - left_real) / img_width),
+              delta_img((top_imag - bottom_imag) / img_height) {};
+    view_map(complex_t left_top, complex_t right_bottom, size_t img_width, size_t img_height)
+            : view_map(left_top.real(), left_top.imag(), right_bottom.real(), right_bottom.imag(), img_width,
+                       img_height) {};
+
+    [[nodiscard]] T real_at(T x) const {return left_real + x * delta_real;};
+    [[nodiscard]] T imag_at(T y) const {return top_imag - y * delta_img;};
+    [[nodiscard]] complex_t point(size_t x, size_t y) const {return complex_t{real_at(x), imag_at(y)};};
+    //the inverse, which lands back on the pixel real_at and imag_at started from to within rounding
+    [[nodiscard]] T x_at(T real) const {return (real - left_real) / delta_real;};
+    [[nodiscard]] T y_at(T imag) const {return (top_imag - imag) / delta_img;};
+    //the same pixel size with pixel (0, 0) moved to real, imag
+    [[nodiscard]] view_map anchored_at(T real, T imag) const {
+        view_map anchored = *this;
+        anchored.left_real = real;
+        anchored.top_imag = imag;
+        return anchored;
+    };
+};
+
+//count interleaved (x, y) pairs to (real, imag) pairs, in may be out
+template<typename T>
+void pixels_to_points(const view_map<T>& map, const T* in, size_t count, T* out) {
+    for (size_t i = 0; i < count; i++) {
+        T const x = in[2 * i], y = in[2 * i + 1];
+        out[2 * i] = map.real_at(x);
+        out[2 * i + 1] = map.imag_at(y);
+    }
+}
+
+//count interleaved (real, imag) pairs to (x, y) pairs, in may be out
+template<typename T>
+void points_to_pixels(const view_map<T>& map, const T* in, size_t count, T* out) {
+    for (size_t i = 0; i < count; i++) {
+        T const real = in[2 * i], imag = in[2 * i + 1];
+        out[2 * i] = map.x_at(real);
+        out[2 * i + 1] = map.y_at(imag);
+    }
+}
+
+/*
+ * Maps every "x y" line read from the in descriptor to a "real imag" line on out for the view given by the 4
+ * coordinate strings, or every "real imag" line back to "x y" with to_pixels. Lines are mapped in batches and written
+ * with enough digits to parse back to the same value, so a selection round trips. extended does it all in long
+ * double, coordinates included, which are parsed from the strings so none of their digits are lost to double on the
+ * way. A line that doesn't parse still gets a "nan nan" line so output lines match the input's, other than blank
+ * lines which are skipped. Lines are answered as soon as they're read, a batch being however many have arrived.
+ * Returns 0 if every line parsed.
+ */
+int stream_view_map(const char* const view[4], size_t img_width, size_t img_height, bool to_pixels, bool extended,
+                    int in, FILE* out);
+
+#endif //FRACTALFUN_VIEW_MAP_H